@@ -0,0 +1,102 @@
+// Measures where driving a query by the entity list of its rarest component (probing each of
+// those entities) gets cheaper than walking the signatures of every entity, for
+// manager::driver_probe_cost. The rare component is a tag on a shrinking share of the entities.
+
+#include <ecs/manager.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <random>
+
+using boost::hana::make_tuple;
+using namespace ecs;
+
+struct transform
+{
+	float x, y, z, rotation;
+};
+struct burning
+{
+};
+
+// the fastest of `repetitions` runs, in milliseconds
+template <typename F>
+double time_ms(F&& func, int repetitions)
+{
+	double best = 0.0;
+	for (int i = 0; i < repetitions; ++i)
+		{
+			auto start = std::chrono::steady_clock::now();
+			func();
+			auto end = std::chrono::steady_clock::now();
+
+			auto duration = std::chrono::duration<double, std::milli>(end - start).count();
+			if (i == 0 || duration < best) best = duration;
+		}
+	return best;
+}
+
+int main()
+{
+	constexpr size_t numEntities = 1 << 20;
+	constexpr int repetitions = 10;
+
+	auto signature = make_type_tuple<transform, burning>;
+	auto update = [](transform& t) { t.rotation += 1.f; };
+
+	std::printf("%zu entities with a transform\n", numEntities);
+	std::printf("burning share   scan (ms)   driven (ms)   scan slots / driven entities\n");
+	for (size_t share = 2; share <= 256; share *= 2)
+		{
+			auto man = create_manager(make_type_tuple<transform, burning>);
+
+			// the burning entities are spread out at random, like they would be in a game
+			std::vector<size_t> order(numEntities);
+			std::iota(order.begin(), order.end(), size_t(0));
+			std::shuffle(order.begin(), order.end(), std::mt19937{42});
+			std::vector<bool> isBurning(numEntities);
+			for (size_t i = 0; i < numEntities / share; ++i)
+				{
+					isBurning[order[i]] = true;
+				}
+			for (size_t i = 0; i < numEntities; ++i)
+				{
+					if (isBurning[i])
+						{
+							man.new_entity(signature);
+						}
+					else
+						{
+							man.new_entity(make_type_tuple<transform>);
+						}
+				}
+
+			auto required = man.generate_runtime_signature(signature);
+			auto scan = time_ms(
+				[&] {
+					auto cursor = man.get_component_storage(boost::hana::type_c<transform>)
+									  .make_cursor();
+					man.entitySignatures.for_each([&](size_t id, const auto& entitySignature) {
+						if ((entitySignature & required) == required) update(cursor[id]);
+					});
+				},
+				repetitions);
+			auto driven = time_ms(
+				[&] {
+					auto cursor = man.get_component_storage(boost::hana::type_c<transform>)
+									  .make_cursor();
+					auto& driver = man.get_entity_list(boost::hana::type_c<burning>);
+					for (auto id : man.probe_driver(driver, required))
+						{
+							update(cursor[id]);
+						}
+				},
+				repetitions);
+
+			std::printf("1/%-12zu %9.3f   %11.3f   %zu (%s)\n", share, scan, driven,
+						man.entitySignatures.end_key() / (numEntities / share),
+						driven < scan ? "driven is faster" : "scan is faster");
+		}
+}
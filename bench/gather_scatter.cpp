@@ -0,0 +1,85 @@
+// Compares reading and writing a component of a random list of entities one get_storage_component
+// at a time with manager::gather() and manager::scatter(), which visit the storage segment by
+// segment. The lists go from a handful of IDs, where ordering them must not cost a pass over the
+// whole storage, to a quarter of the entities.
+
+#include <ecs/manager.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <random>
+
+using boost::hana::make_tuple;
+using boost::hana::type_c;
+using namespace ecs;
+
+struct transform
+{
+	float position[3], rotation[4], scale[3];
+};
+
+// the fastest of `repetitions` runs of `func(repetition)`, in microseconds
+template <typename F>
+double time_us(F&& func, int repetitions)
+{
+	double best = 0.0;
+	for (int i = 0; i < repetitions; ++i)
+		{
+			auto start = std::chrono::steady_clock::now();
+			func(i);
+			auto end = std::chrono::steady_clock::now();
+
+			auto duration = std::chrono::duration<double, std::micro>(end - start).count();
+			if (i == 0 || duration < best) best = duration;
+		}
+	return best;
+}
+
+int main()
+{
+	constexpr size_t numEntities = 1 << 20;
+	constexpr int repetitions = 10;
+
+	auto man = create_manager(make_type_tuple<transform>);
+	for (size_t i = 0; i < numEntities; ++i)
+		{
+			man.new_entity(make_type_tuple<transform>);
+		}
+
+	std::printf("%zu entities, a %zu byte component\n", numEntities, sizeof(transform));
+	std::printf("ids        per entity (us)   gather (us)   scatter back (us)\n");
+	std::mt19937 random{42};
+	for (size_t numIds = 16; numIds <= numEntities / 4; numIds *= 4)
+		{
+			// a different list every repetition, so the components aren't in the cache already
+			std::vector<std::vector<size_t>> lists(repetitions);
+			for (auto& ids : lists)
+				{
+					ids.resize(numEntities);
+					std::iota(ids.begin(), ids.end(), size_t(0));
+					std::shuffle(ids.begin(), ids.end(), random);
+					ids.resize(numIds);
+				}
+
+			std::vector<transform> buffer(numIds);
+			auto perEntity = time_us(
+				[&](int rep) {
+					for (size_t i = 0; i < numIds; ++i)
+						{
+							buffer[i] =
+								man.get_storage_component(type_c<transform>, lists[rep][i]);
+						}
+				},
+				repetitions);
+			auto gathered = time_us(
+				[&](int rep) { man.gather(type_c<transform>, lists[rep], buffer.begin()); },
+				repetitions);
+			auto scattered = time_us(
+				[&](int rep) { man.scatter(type_c<transform>, lists[rep], buffer.begin()); },
+				repetitions);
+
+			std::printf("%-10zu %15.1f %13.1f %19.1f\n", numIds, perEntity, gathered, scattered);
+		}
+}
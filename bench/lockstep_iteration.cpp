@@ -0,0 +1,104 @@
+// Compares walking a 3 component signature with large components through run_all_matching (which
+// walks every storage in lockstep, resolving each segment once) with resolving every component of
+// every entity on its own, like call_function_with_signature_params does.
+
+#include <ecs/manager.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+
+using boost::hana::make_tuple;
+using namespace ecs;
+
+template <int N>
+struct big_component
+{
+	double data[18];
+};
+
+using comp1 = big_component<1>;
+using comp2 = big_component<2>;
+using comp3 = big_component<3>;
+
+// the fastest of `repetitions` runs, in milliseconds
+template <typename F>
+double time_ms(F&& func, int repetitions)
+{
+	double best = 0.0;
+	for (int i = 0; i < repetitions; ++i)
+		{
+			auto start = std::chrono::steady_clock::now();
+			func();
+			auto end = std::chrono::steady_clock::now();
+
+			auto duration = std::chrono::duration<double, std::milli>(end - start).count();
+			if (i == 0 || duration < best) best = duration;
+		}
+	return best;
+}
+
+int main()
+{
+	constexpr size_t numEntities = 200000;
+	constexpr int repetitions = 20;
+
+	// fragment the heap like a long running game would, so the segments don't end up next to
+	// each other in allocation order: free every other block (so they can't be merged) in a
+	// random order
+	std::vector<std::unique_ptr<char[]>> blocks(numEntities * 8);
+	for (auto& block : blocks)
+		{
+			block.reset(new char[sizeof(comp1)]);
+		}
+	std::vector<size_t> toFree;
+	for (size_t i = 1; i < blocks.size(); i += 2)
+		{
+			toFree.push_back(i);
+		}
+	std::shuffle(toFree.begin(), toFree.end(), std::mt19937{42});
+	for (auto i : toFree)
+		{
+			blocks[i].reset();
+		}
+
+	auto man = create_manager(make_type_tuple<comp1, comp2, comp3>);
+
+	for (size_t i = 0; i < numEntities; ++i)
+		{
+			// every fourth entity doesn't match
+			if (i % 4 == 3)
+				{
+					man.new_entity(make_type_tuple<comp1, comp2>);
+				}
+			else
+				{
+					man.new_entity(make_type_tuple<comp1, comp2, comp3>);
+				}
+		}
+
+	auto signature = make_type_tuple<comp1, comp2, comp3>;
+	auto update = [](comp1& a, const comp2& b, const comp3& c) {
+		a.data[0] += b.data[0] * c.data[0] + 1.0;
+	};
+
+	auto perEntity = time_ms(
+		[&] {
+			auto required = man.generate_runtime_signature(signature);
+			man.entitySignatures.for_each([&](size_t id, const auto& entitySignature) {
+				if ((entitySignature & required) == required)
+					{
+						man.call_function_with_signature_params(id, signature, update);
+					}
+			});
+		},
+		repetitions);
+
+	auto lockstep = time_ms([&] { man.run_all_matching(signature, update); }, repetitions);
+
+	std::printf("%zu entities, 3 components of %zu bytes\n", numEntities, sizeof(comp1));
+	std::printf("per entity lookups: %8.3f ms\n", perEntity);
+	std::printf("lockstep walk:      %8.3f ms (%.2fx)\n", lockstep, perEntity / lockstep);
+}
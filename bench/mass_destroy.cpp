@@ -0,0 +1,66 @@
+// Measures destroying a quarter of the entities, in random order, like the deaths of a large
+// battle. Removing an entity from the list of entities having a component is O(1), so the time
+// per destroy should stay flat as the number of entities grows.
+
+#include <ecs/manager.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <vector>
+
+using boost::hana::make_tuple;
+using namespace ecs;
+
+struct position
+{
+	float x, y, z;
+};
+struct velocity
+{
+	float x, y, z;
+};
+struct enemy
+{
+};
+
+int main()
+{
+	constexpr int repetitions = 5;
+	constexpr auto signature = make_type_tuple<position, velocity, enemy>;
+
+	std::printf("entities   destroyed   total (ms)   per destroy (ns)\n");
+	for (size_t numEntities = 20000; numEntities <= 1280000; numEntities *= 4)
+		{
+			size_t numDestroyed = numEntities / 4;
+
+			std::vector<size_t> order(numEntities);
+			std::iota(order.begin(), order.end(), size_t(0));
+			std::shuffle(order.begin(), order.end(), std::mt19937{42});
+			order.resize(numDestroyed);
+
+			// the fastest of `repetitions` runs; only the destroys are timed
+			double best = 0.0;
+			for (int i = 0; i < repetitions; ++i)
+				{
+					auto man = create_manager(make_type_tuple<position, velocity, enemy>);
+					man.create_entity_batch(signature, make_tuple(position{}, velocity{}),
+											numEntities);
+
+					auto start = std::chrono::steady_clock::now();
+					for (auto id : order)
+						{
+							man.destroy_entity(id);
+						}
+					auto end = std::chrono::steady_clock::now();
+
+					auto duration = std::chrono::duration<double, std::milli>(end - start).count();
+					if (i == 0 || duration < best) best = duration;
+				}
+
+			std::printf("%8zu %11zu %12.3f %18.1f\n", numEntities, numDestroyed, best,
+						best * 1e6 / double(numDestroyed));
+		}
+}
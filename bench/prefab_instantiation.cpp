@@ -0,0 +1,71 @@
+// Compares creating many copies of one entity with new_entity in a loop with instantiating a
+// prefab, which fills whole segments at once.
+
+#include <ecs/manager.hpp>
+
+#include <chrono>
+#include <cstdio>
+
+using boost::hana::make_tuple;
+using namespace ecs;
+
+struct position
+{
+	float x, y, z;
+};
+struct velocity
+{
+	float x, y, z;
+};
+struct projectile
+{
+	float damage;
+	int owner;
+	int ttl;
+};
+
+// the fastest of `repetitions` runs of `func(manager)` on a new manager, in milliseconds
+template <typename F>
+double time_ms(F&& func, int repetitions)
+{
+	double best = 0.0;
+	for (int i = 0; i < repetitions; ++i)
+		{
+			auto man = create_manager(make_type_tuple<position, velocity, projectile>);
+
+			auto start = std::chrono::steady_clock::now();
+			func(man);
+			auto end = std::chrono::steady_clock::now();
+
+			auto duration = std::chrono::duration<double, std::milli>(end - start).count();
+			if (i == 0 || duration < best) best = duration;
+		}
+	return best;
+}
+
+int main()
+{
+	constexpr size_t numEntities = 100000;
+	constexpr int repetitions = 10;
+
+	auto signature = make_type_tuple<position, velocity, projectile>;
+	auto components =
+		make_tuple(position{1.f, 2.f, 3.f}, velocity{0.f, 0.f, 10.f}, projectile{5.f, 1, 60});
+
+	auto loop = time_ms(
+		[&](auto& man) {
+			for (size_t i = 0; i < numEntities; ++i)
+				{
+					man.new_entity(signature, components);
+				}
+		},
+		repetitions);
+
+	prefab<decltype(signature), decltype(components)> pf{signature, components};
+	auto instantiated =
+		time_ms([&](auto& man) { man.instantiate(pf, numEntities); }, repetitions);
+
+	std::printf("%zu entities with 3 components\n", numEntities);
+	std::printf("new_entity loop: %8.3f ms\n", loop);
+	std::printf("instantiate:     %8.3f ms (%.2fx)\n", instantiated, loop / instantiated);
+}
@@ -0,0 +1,109 @@
+// Measures the snapshots of a rollback netcode loop: every tick a few entities are moved, created
+// and destroyed, then the tick is saved, keeping a window of the last ticks. Once in a while a
+// late input rolls the game back to the start of the window. Most components don't gain or lose
+// entities in a tick, so only a few entity lists and segments should be copied.
+
+#include <ecs/manager.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+using boost::hana::make_tuple;
+using boost::hana::type_c;
+using namespace ecs;
+
+struct position
+{
+	float x, y, z;
+};
+struct velocity
+{
+	float x, y, z;
+};
+struct health
+{
+	int value;
+};
+struct team
+{
+	int value;
+};
+struct projectile
+{
+	float lifetime;
+};
+struct unit
+{
+};
+
+using clock_type = std::chrono::steady_clock;
+
+double elapsed_us(clock_type::time_point start)
+{
+	return std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+}
+
+int main()
+{
+	constexpr size_t numUnits = 1000000;
+	constexpr size_t window = 8;
+	constexpr int numTicks = 200;
+	constexpr size_t movedPerTick = 1000, projectilesPerTick = 20;
+
+	auto man = create_manager(
+		make_type_tuple<position, velocity, health, team, projectile, unit>);
+	man.create_entity_batch(make_type_tuple<position, velocity, health, team, unit>,
+							make_tuple(position{}, velocity{}, health{100}, team{0}), numUnits);
+
+	std::deque<decltype(man.snapshot())> snapshots;
+	std::deque<size_t> projectiles;
+	double snapshotTime = 0.0, tickTime = 0.0, restoreTime = 0.0;
+	int restores = 0;
+
+	for (int tick = 0; tick < numTicks; ++tick)
+		{
+			auto start = clock_type::now();
+			for (size_t i = 0; i < movedPerTick; ++i)
+				{
+					auto id = (size_t(tick) * 7919 + i * 104729) % numUnits;
+					man.get_storage_component(type_c<position>, id).x += 1.f;
+				}
+			for (size_t i = 0; i < projectilesPerTick; ++i)
+				{
+					projectiles.push_back(
+						man.new_entity(make_type_tuple<position, projectile>,
+									   make_tuple(position{}, projectile{1.f}))
+							.id);
+				}
+			while (projectiles.size() > 5 * projectilesPerTick)
+				{
+					man.destroy_entity(projectiles.front());
+					projectiles.pop_front();
+				}
+			tickTime += elapsed_us(start);
+
+			start = clock_type::now();
+			snapshots.push_back(man.snapshot());
+			if (snapshots.size() > window) snapshots.pop_front();
+			snapshotTime += elapsed_us(start);
+
+			if (tick % 50 == 49)
+				{
+					start = clock_type::now();
+					man.restore(snapshots.front());
+					restoreTime += elapsed_us(start);
+					++restores;
+
+					// the restored ticks are simulated again
+					snapshots.clear();
+					projectiles.clear();
+				}
+		}
+
+	std::printf("%zu units, a window of %zu snapshots\n", numUnits, window);
+	std::printf("tick (us)   snapshot (us)   restore (us)\n");
+	std::printf("%9.1f %15.1f %14.1f\n", tickTime / numTicks, snapshotTime / numTicks,
+				restoreTime / restores);
+}
@@ -0,0 +1,137 @@
+// Measures segmented_map with a range of segment sizes for components of a few sizes, and
+// recommends a segment size for each: the one with the lowest total of filling the map, walking it
+// and looking up random keys. Use the result to specialize segment_traits for your components.
+
+#include <ecs/segmented_map.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+
+template <size_t Bytes>
+struct payload
+{
+	unsigned char data[Bytes];
+};
+
+// the fastest of `repetitions` runs, in milliseconds
+template <typename F>
+double time_ms(F&& func, int repetitions)
+{
+	double best = 0.0;
+	for (int i = 0; i < repetitions; ++i)
+		{
+			auto start = std::chrono::steady_clock::now();
+			func();
+			auto end = std::chrono::steady_clock::now();
+
+			auto duration = std::chrono::duration<double, std::milli>(end - start).count();
+			if (i == 0 || duration < best) best = duration;
+		}
+	return best;
+}
+
+struct result
+{
+	size_t segment_size;
+	double fill, walk, lookup;
+	size_t bytes;
+
+	double total() const { return fill + walk + lookup; }
+};
+
+template <size_t Bytes, size_t SegmentSize>
+result measure(const std::vector<size_t>& keys, const std::vector<size_t>& lookups)
+{
+	constexpr int repetitions = 5;
+	using map_type = segmented_map<size_t, payload<Bytes>, std::less<size_t>,
+								   std::allocator<std::pair<size_t, payload<Bytes>>>, SegmentSize>;
+
+	result ret{SegmentSize, 0.0, 0.0, 0.0, 0};
+
+	ret.fill = time_ms(
+		[&] {
+			map_type map;
+			for (auto key : keys)
+				{
+					map.try_emplace(key);
+				}
+		},
+		repetitions);
+
+	map_type map;
+	for (auto key : keys)
+		{
+			map.try_emplace(key);
+		}
+	ret.bytes = map.memory_stats().total_bytes();
+
+	volatile unsigned sink = 0;
+	ret.walk = time_ms(
+		[&] {
+			unsigned sum = 0;
+			map.for_each([&sum](size_t, payload<Bytes>& value) { sum += value.data[0]++; });
+			sink = sink + sum;
+		},
+		repetitions);
+	ret.lookup = time_ms(
+		[&] {
+			unsigned sum = 0;
+			for (auto key : lookups)
+				{
+					sum += map[key].data[0]++;
+				}
+			sink = sink + sum;
+		},
+		repetitions);
+
+	return ret;
+}
+
+template <size_t Bytes, size_t... SegmentSizes>
+void sweep(std::index_sequence<SegmentSizes...>)
+{
+	// about 32 MiB of elements, with every eighth key missing like destroyed entities
+	constexpr size_t numKeys = std::min<size_t>((32u << 20) / Bytes, 1u << 18);
+
+	std::vector<size_t> keys;
+	for (size_t i = 0; i < numKeys; ++i)
+		{
+			if (i % 8 != 7) keys.push_back(i);
+		}
+	std::vector<size_t> lookups = keys;
+	std::shuffle(lookups.begin(), lookups.end(), std::mt19937{42});
+
+	std::printf("%zu byte elements, %zu keys (default segment size %zu)\n", Bytes, keys.size(),
+				segment_traits<payload<Bytes>>::elements);
+	std::printf("  segment   fill ms   walk ms lookup ms    MiB\n");
+
+	std::vector<result> results{measure<Bytes, SegmentSizes>(keys, lookups)...};
+	for (auto& res : results)
+		{
+			std::printf("  %7zu %9.3f %9.3f %9.3f %6.1f\n", res.segment_size, res.fill, res.walk,
+						res.lookup, res.bytes / double(1 << 20));
+		}
+
+	auto best = std::min_element(results.begin(), results.end(),
+								 [](const result& a, const result& b) {
+									 return a.total() < b.total();
+								 });
+	std::printf("  recommended: %zu elements per segment\n\n", best->segment_size);
+}
+
+int main()
+{
+	using sizes = std::index_sequence<1, 4, 8, 16, 32, 64, 128, 256, 512>;
+
+	sweep<8>(sizes{});
+	sweep<16>(sizes{});
+	sweep<64>(sizes{});
+	sweep<144>(sizes{});
+	sweep<512>(sizes{});
+	sweep<2048>(sizes{});
+}
@@ -0,0 +1,166 @@
+// Replays a workload trace on two storage configurations of the same components, and prints how
+// long each operation took on each. Without arguments it records a made up workload (units being
+// spawned, moved and killed every frame) first, and prints how much recording slowed it down;
+// `workload_replay trace.bin` replays a trace written by workload_trace::write() instead, and
+// `workload_replay - trace.bin` writes the made up one there.
+//
+// A trace only names its components, so to replay one of your own, copy this with your component
+// types, signatures and configurations.
+
+#include <ecs/workload_replay.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+using boost::hana::make_tuple;
+using namespace ecs;
+
+struct position
+{
+	float x, y, z;
+};
+struct velocity
+{
+	float x, y, z;
+};
+struct health
+{
+	int value;
+};
+struct projectile
+{
+};
+
+constexpr auto components = make_type_tuple<position, velocity, health, projectile>;
+constexpr auto signatures =
+	make_tuple(make_type_tuple<position, velocity, health>, make_type_tuple<position, velocity>,
+			   make_type_tuple<position, velocity, projectile>, make_type_tuple<health>,
+			   make_type_tuple<position, velocity, without<projectile>>);
+
+// a few hundred frames of units and projectiles being made, moved and destroyed
+template <typename Manager>
+void run_game(Manager& man)
+{
+	std::mt19937 random{42};
+	std::vector<size_t> units, projectiles;
+	query_cursor aiCursor;
+
+	for (int frame = 0; frame < 300; ++frame)
+		{
+			auto spawned = man.create_entity_batch(make_type_tuple<position, velocity, health>,
+												   make_tuple(position{}, velocity{}, health{100}),
+												   100);
+			for (auto& made : spawned)
+				{
+					units.push_back(made.id);
+				}
+			for (int i = 0; i < 300; ++i)
+				{
+					projectiles.push_back(
+						man.new_entity(make_type_tuple<position, velocity, projectile>).id);
+				}
+
+			man.run_all_matching(make_type_tuple<position, velocity>,
+								 [](position& p, velocity& v) {
+									 p.x += v.x;
+									 p.y += v.y;
+									 p.z += v.z;
+								 });
+			man.run_all_matching(make_type_tuple<position, velocity, without<projectile>>,
+								 [](position& p, velocity& v) { v.x = p.y - p.x; });
+			query_budget ai;
+			ai.max_entities = 1000;
+			man.run_some_matching(make_type_tuple<health>, aiCursor, [](health& h) { --h.value; },
+								  ai);
+
+			// most projectiles hit something the frame after they are made, a few units die
+			while (projectiles.size() > 30)
+				{
+					auto i = random() % projectiles.size();
+					man.destroy_entity(projectiles[i]);
+					projectiles[i] = projectiles.back();
+					projectiles.pop_back();
+				}
+			for (int i = 0; i < 80 && !units.empty(); ++i)
+				{
+					auto unit = random() % units.size();
+					man.destroy_entity(units[unit]);
+					units[unit] = units.back();
+					units.pop_back();
+				}
+		}
+}
+
+double to_ms(std::chrono::nanoseconds time)
+{
+	return std::chrono::duration<double, std::milli>(time).count();
+}
+
+int main(int argc, char** argv)
+{
+	workload_trace trace;
+	if (argc == 2)
+		{
+			std::ifstream file{argv[1], std::ios::binary};
+			trace = workload_trace::read(file);
+		}
+	else
+		{
+			auto unrecorded = create_manager(components);
+			auto start = std::chrono::steady_clock::now();
+			run_game(unrecorded);
+			auto plain = std::chrono::steady_clock::now() - start;
+
+			auto recorded = create_manager(components);
+			workload_recorder recorder;
+			recorded.record_workload(&recorder);
+			start = std::chrono::steady_clock::now();
+			run_game(recorded);
+			auto recording = std::chrono::steady_clock::now() - start;
+			trace = recorder.trace();
+
+			std::printf("made up workload: %.3f ms, %.3f ms while recording\n", to_ms(plain),
+						to_ms(recording));
+			if (argc == 3 && std::strcmp(argv[1], "-") == 0)
+				{
+					std::ofstream file{argv[2], std::ios::binary};
+					trace.write(file);
+				}
+		}
+
+	std::ostringstream encoded;
+	trace.write(encoded);
+	std::printf("%zu events, %zu bytes\n\n", trace.events.size(), encoded.str().size());
+
+	// everything in one manager
+	auto flat = create_manager(components);
+	auto flatStats = replay_workload(flat, trace, signatures);
+
+	// the physics in a base manager, the gameplay in a derived one
+	auto physics = create_manager(make_type_tuple<position, velocity>);
+	auto gameplay = create_manager(make_type_tuple<health, projectile>, make_tuple(&physics));
+	auto layeredStats = replay_workload(gameplay, trace, signatures);
+
+	const char* names[] = {"new_entity",
+						   "create_entity_batch",
+						   "instantiate",
+						   "destroy_entity",
+						   "run_all_matching",
+						   "run_some_matching",
+						   "query"};
+	std::printf("operation             calls     flat (ms)   layered (ms)\n");
+	for (size_t op = 0; op < size_t(workload_op::count); ++op)
+		{
+			if (!flatStats.calls[op]) continue;
+
+			std::printf("%-20s %6zu %13.3f %14.3f\n", names[op], flatStats.calls[op],
+						to_ms(flatStats.time[op]), to_ms(layeredStats.time[op]));
+		}
+	std::printf("%-20s %6zu %13.3f %14.3f\n", "total", trace.events.size(),
+				to_ms(flatStats.total_time()), to_ms(layeredStats.total_time()));
+}
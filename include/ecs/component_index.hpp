@@ -0,0 +1,248 @@
+/// @brief This defines secondary indexes, which find entities by the value of a component field
+
+#pragma once
+
+#include <boost/iterator/iterator_facade.hpp>
+
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ecs/manager.hpp"
+
+namespace ecs
+{
+/**
+ * @brief Maps a key computed from a component (usually one of its fields) to the entities having
+ * it. Use it through hash_index (equality lookups) or ordered_index (range lookups).
+ *
+ * The index is kept up to date by observers on the component, so it catches up with the manager in
+ * flush_observers(); writes in between cost nothing. Creating and destroying entities is picked
+ * up automatically, writes to the component only once they are reported with
+ * manager::mark_changed(). Entities renumbered by manager::compact() and
+ * manager::sort_entities() are followed right away. A manager::restore() is reported like any
+ * other change, so the index catches up with it at the next flush.
+ *
+ * \c Container maps each key to the list of entities having it, and every entity knows its place
+ * in its list, so an entity is moved or removed in O(1) however many share its key. The iterators
+ * go over (key, entity ID) pairs. The observers are unregistered when the index (and every copy of
+ * it) is gone; the manager must outlive it.
+ */
+template <typename Key, typename Container>
+class component_index
+{
+public:
+	/// @brief A forward iterator over (key, entity ID) pairs
+	class const_iterator
+		: public boost::iterator_facade<const_iterator, std::pair<Key, size_t>,
+										std::forward_iterator_tag,
+										std::pair<const Key&, size_t>>
+	{
+	public:
+		const_iterator() = default;
+		const_iterator(typename Container::const_iterator list_, size_t position_ = 0)
+			: list{list_}, position{position_}
+		{
+		}
+
+	private:
+		friend class boost::iterator_core_access;
+
+		std::pair<const Key&, size_t> dereference() const
+		{
+			return {list->first, list->second[position]};
+		}
+		bool equal(const const_iterator& other) const
+		{
+			return list == other.list && position == other.position;
+		}
+		void increment()
+		{
+			// the lists are never empty
+			if (++position == list->second.size())
+				{
+					++list;
+					position = 0;
+				}
+		}
+
+		typename Container::const_iterator list;
+		size_t position = 0;
+	};
+
+	/**
+	 * @brief Indexes \c component of the entities of \c man by \c key_of(component value),
+	 * starting with the entities that have it already
+	 */
+	template <typename Manager, typename T, typename F>
+	component_index(Manager& man, T component, F key_of) : state{std::make_shared<index_state>()}
+	{
+		BOOST_HANA_CONSTANT_CHECK(Manager::isStorageComponent(component));
+
+		state->key_of = [&man, key_of](size_t id) {
+			return key_of(man.get_storage_component(T{}, id));
+		};
+		state->has_component = [&man](size_t id) { return man.has_component(T{}, id); };
+
+		// the observers only hold on to the state weakly, so they do nothing once the index is gone
+		std::weak_ptr<index_state> weakState = state;
+		auto update = [weakState](const std::vector<size_t>& ids) {
+			if (auto locked = weakState.lock()) locked->update(ids);
+		};
+		std::array<size_t, 4> observerIDs{
+			man.on_add(component, update), man.on_change(component, update),
+			man.on_remove(component, update),
+			man.on_renumber(component,
+							[weakState](const std::vector<std::pair<size_t, size_t>>& moves) {
+								if (auto locked = weakState.lock()) locked->renumber(moves);
+							})};
+		state->unregister = [&man, observerIDs] {
+			for (auto id : observerIDs)
+				{
+					man.remove_observer(T{}, id);
+				}
+		};
+
+		state->update(man.get_entity_list(component));
+	}
+
+	/// @brief The entities whose key is \c key
+	std::pair<const_iterator, const_iterator> equal_range(const Key& key) const
+	{
+		auto list = state->entries.find(key);
+		if (list == state->entries.end()) return {end(), end()};
+		return {const_iterator{list}, const_iterator{std::next(list)}};
+	}
+
+	/// @brief An entity whose key is \c key, or invalid_entity if there is none
+	size_t find(const Key& key) const
+	{
+		auto list = state->entries.find(key);
+		return list == state->entries.end() ? invalid_entity : list->second.front();
+	}
+
+	size_t count(const Key& key) const
+	{
+		auto list = state->entries.find(key);
+		return list == state->entries.end() ? 0 : list->second.size();
+	}
+
+	/// @brief How many entities are indexed
+	size_t size() const { return state->size; }
+
+	const_iterator begin() const { return {state->entries.begin()}; }
+	const_iterator end() const { return {state->entries.end()}; }
+
+	/// @brief The entities whose key is in [\c first, \c last); only for ordered_index
+	std::pair<const_iterator, const_iterator> range(const Key& first, const Key& last) const
+	{
+		return {const_iterator{state->entries.lower_bound(first)},
+				const_iterator{state->entries.lower_bound(last)}};
+	}
+
+private:
+	// where an indexed entity is filed
+	struct entry
+	{
+		Key key;
+		size_t position;
+	};
+
+	struct index_state
+	{
+		~index_state()
+		{
+			if (unregister) unregister();
+		}
+
+		Container entries;
+		// the entry of every indexed entity, for when it changes or goes away
+		segmented_map<size_t, entry> keys;
+		size_t size = 0;
+
+		std::function<Key(size_t)> key_of;
+		std::function<bool(size_t)> has_component;
+		std::function<void()> unregister;
+
+		// brings the entries of `ids` up to date. Whether the entity was added, changed or removed
+		// doesn't matter: an ID may have been reused since the event, so only its current state
+		// counts. The IDs are the manager's index_type when read from its entity lists.
+		template <typename Id>
+		void update(const std::vector<Id>& ids)
+		{
+			for (auto id : ids)
+				{
+					auto iter = keys.find(id);
+					bool indexed = iter != keys.end();
+					bool present = has_component(id);
+					if (!indexed && !present) continue;
+
+					if (indexed)
+						{
+							if (present && iter->second.key == key_of(id)) continue;
+
+							erase_entry(iter->second);
+							keys.erase(id);
+						}
+					if (present) add_entry(id, key_of(id));
+				}
+		}
+
+		// moves the entries of the renumbered entities to their new IDs
+		void renumber(const std::vector<std::pair<size_t, size_t>>& moves)
+		{
+			// taken out first, as an entity may move to the ID another one is leaving
+			std::vector<std::pair<size_t, entry>> moved;
+			for (auto& move : moves)
+				{
+					auto iter = keys.find(move.first);
+					if (iter == keys.end()) continue;
+
+					moved.emplace_back(move.second, std::move(iter->second));
+					keys.erase(move.first);
+				}
+			for (auto& elem : moved)
+				{
+					entries.find(elem.second.key)->second[elem.second.position] = elem.first;
+					keys.insert({elem.first, std::move(elem.second)});
+				}
+		}
+
+		void add_entry(size_t id, Key key)
+		{
+			auto& list = entries[key];
+			keys.insert({id, entry{std::move(key), list.size()}});
+			list.push_back(id);
+			++size;
+		}
+
+		// swaps the last entity with the same key into the place of the entity of `removed`
+		void erase_entry(const entry& removed)
+		{
+			auto list = entries.find(removed.key);
+			auto& ids = list->second;
+
+			auto last = ids.back();
+			ids[removed.position] = last;
+			keys.at(last).position = removed.position;
+			ids.pop_back();
+			if (ids.empty()) entries.erase(list);
+			--size;
+		}
+	};
+
+	std::shared_ptr<index_state> state;
+};
+
+/// @brief A component_index answering equality lookups in O(1)
+template <typename Key, typename Hash = std::hash<Key>>
+using hash_index = component_index<Key, std::unordered_map<Key, std::vector<size_t>, Hash>>;
+
+/// @brief A component_index answering equality and range lookups in O(log n)
+template <typename Key, typename Compare = std::less<Key>>
+using ordered_index = component_index<Key, std::map<Key, std::vector<size_t>, Compare>>;
+}
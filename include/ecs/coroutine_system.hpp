@@ -0,0 +1,263 @@
+/// @brief This defines systems written as C++20 coroutines, and a scheduler that interleaves them
+/// Unlike the rest of the library this needs C++20, so it is only usable when compiling as such.
+
+#pragma once
+
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine)
+#error "ecs/coroutine_system.hpp needs C++20 coroutines"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "ecs/manager.hpp"
+
+namespace ecs
+{
+namespace detail
+{
+/// @brief Recycles coroutine frames, so systems that are started again every frame stop
+/// allocating once the pool has warmed up. Frames are rounded up to a multiple of \c granularity
+/// and kept in one free list per size; frames bigger than \c max_pooled_size are not pooled.
+/// There is one pool per thread; a frame freed on another thread than it was made on simply moves
+/// to that thread's pool.
+class frame_pool
+{
+public:
+	static constexpr size_t granularity = 64;
+	static constexpr size_t max_pooled_size = 64 * granularity;
+
+	static frame_pool& local()
+	{
+		thread_local frame_pool pool;
+		return pool;
+	}
+
+	frame_pool() = default;
+	frame_pool(const frame_pool&) = delete;
+	frame_pool& operator=(const frame_pool&) = delete;
+
+	~frame_pool()
+	{
+		for (auto block : freeLists)
+			{
+				while (block)
+					{
+						auto next = block->next;
+						::operator delete(block);
+						block = next;
+					}
+			}
+	}
+
+	void* allocate(size_t size)
+	{
+		if (size > max_pooled_size) return ::operator new(size);
+
+		auto& list = freeLists[size_class(size)];
+		if (list)
+			{
+				auto block = list;
+				list = block->next;
+				return block;
+			}
+
+		++blocksAllocated;
+		return ::operator new((size_class(size) + 1) * granularity);
+	}
+
+	void deallocate(void* ptr, size_t size) noexcept
+	{
+		if (size > max_pooled_size)
+			{
+				::operator delete(ptr);
+				return;
+			}
+
+		auto& list = freeLists[size_class(size)];
+		list = ::new (ptr) free_block{list};
+	}
+
+	/// @brief How many frames this pool got from the heap so far
+	size_t blocks_allocated() const { return blocksAllocated; }
+
+private:
+	struct free_block
+	{
+		free_block* next;
+	};
+
+	static size_t size_class(size_t size) { return (size - 1) / granularity; }
+
+	std::array<free_block*, max_pooled_size / granularity> freeLists{};
+	size_t blocksAllocated = 0;
+};
+}
+
+/**
+ * @brief The return type of a system written as a coroutine. The coroutine does not start until
+ * it is given to a system_scheduler.
+ *
+ * Inside the system, `co_await yield_now{}` gives the other systems a turn, and
+ * `co_await sync_barrier{}` waits until every other system of the scheduler has reached a barrier
+ * too (or finished).
+ */
+class system_task
+{
+public:
+	struct promise_type
+	{
+		system_task get_return_object()
+		{
+			return system_task{std::coroutine_handle<promise_type>::from_promise(*this)};
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { exception = std::current_exception(); }
+
+		static void* operator new(size_t size) { return detail::frame_pool::local().allocate(size); }
+		static void operator delete(void* ptr, size_t size)
+		{
+			detail::frame_pool::local().deallocate(ptr, size);
+		}
+
+		std::exception_ptr exception;
+		bool atBarrier = false;
+	};
+
+	system_task() = default;
+	system_task(system_task&& other) noexcept : handle{std::exchange(other.handle, nullptr)} {}
+	system_task& operator=(system_task&& other) noexcept
+	{
+		if (this != &other)
+			{
+				if (handle) handle.destroy();
+				handle = std::exchange(other.handle, nullptr);
+			}
+		return *this;
+	}
+	~system_task()
+	{
+		if (handle) handle.destroy();
+	}
+
+	/// @brief If the system ran to the end
+	bool done() const { return !handle || handle.done(); }
+
+private:
+	friend class system_scheduler;
+
+	explicit system_task(std::coroutine_handle<promise_type> handle_) : handle{handle_} {}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+/// @brief Suspends the system until the scheduler gets back to it in its next step
+struct yield_now : std::suspend_always
+{
+};
+
+/// @brief Suspends the system until every system of its scheduler is suspended at a barrier or
+/// done
+struct sync_barrier
+{
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<system_task::promise_type> handle) const noexcept
+	{
+		handle.promise().atBarrier = true;
+	}
+	void await_resume() const noexcept {}
+};
+
+/**
+ * @brief Runs systems written as coroutines, taking turns between them every time one of them
+ * suspends. Everything runs on the thread calling step() or run().
+ */
+class system_scheduler
+{
+public:
+	/// @brief Adds a system to run, starting at the next step()
+	void spawn(system_task task) { tasks.push_back(std::move(task)); }
+
+	/**
+	 * @brief Resumes every system that isn't waiting at a barrier once, in the order they were
+	 * spawned. Exceptions thrown by a system are rethrown from here.
+	 *
+	 * @return If there are systems that didn't finish yet
+	 */
+	bool step()
+	{
+		for (size_t i = 0; i < tasks.size(); ++i)
+			{
+				auto handle = tasks[i].handle;
+				if (handle.done() || handle.promise().atBarrier) continue;
+
+				handle.resume();
+				if (handle.promise().exception)
+					{
+						auto exception = handle.promise().exception;
+						tasks.erase(tasks.begin() + i);
+						std::rethrow_exception(exception);
+					}
+			}
+
+		tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+								   [](const system_task& task) { return task.done(); }),
+					tasks.end());
+
+		// release the barrier once everyone got to it
+		if (std::all_of(tasks.begin(), tasks.end(),
+						[](const system_task& task) { return task.handle.promise().atBarrier; }))
+			{
+				for (auto& task : tasks)
+					{
+						task.handle.promise().atBarrier = false;
+					}
+			}
+
+		return !tasks.empty();
+	}
+
+	/// @brief Steps until every system is done
+	void run()
+	{
+		while (step())
+			{
+			}
+	}
+
+	/// @brief How many systems didn't finish yet
+	size_t size() const { return tasks.size(); }
+
+private:
+	std::vector<system_task> tasks;
+};
+
+/**
+ * @brief A system that calls \c functor for every entity matching \c signature, like
+ * manager::run_all_matching(), yielding to the other systems every \c batch_size entities (at
+ * least one).
+ *
+ * The entities are walked with manager::run_some_matching(), so \c signature is a plain list of
+ * components: without<T> and optional<T> terms aren't supported.
+ */
+template <typename Manager, typename T, typename F>
+system_task run_all_matching_async(Manager& man, T signature, F functor, size_t batch_size)
+{
+	query_cursor cursor;
+	query_budget budget;
+	budget.max_entities = batch_size;
+
+	while (!man.run_some_matching(signature, cursor, functor, budget))
+		{
+			co_await yield_now{};
+		}
+}
+}
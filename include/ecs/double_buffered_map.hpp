@@ -0,0 +1,116 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "ecs/segmented_map.hpp"
+
+// A segmented_map holding two values per key: the map itself is the read buffer, and `next()`
+// the write buffer. flip() swaps them in O(1), so systems reading the previous frame and writing
+// the next one never touch the same memory, and can run in parallel without locking.
+//
+// Both buffers always hold the same keys: inserting, erasing and moving keys goes to both, the
+// value of a new key being copied to the write buffer. The write buffer is not reset by a flip,
+// it holds the values of the frame before the previous one, so a system has to write every value
+// it owns each frame. Writes to the read buffer are lost at the next flip.
+//
+// Only the operations managers use are kept in sync; the map's own insert() and erase() by
+// iterator only touch the read buffer. Unlike a segmented_map, merge() leaves no segment shared,
+// so that different threads can write to different values right away.
+template <typename Key, typename Value>
+class double_buffered_map : public segmented_map<Key, Value>
+{
+	using base = segmented_map<Key, Value>;
+
+public:
+	using typename base::key_type;
+	using typename base::size_type;
+	using typename base::iterator;
+
+	// the write buffer
+	base& next() { return nextBuffer; }
+	const base& next() const { return nextBuffer; }
+
+	// makes the write buffer the read buffer and the other way around
+	void flip() { base::swap(nextBuffer); }
+
+	// see segmented_map::unshare()
+	void unshare()
+	{
+		base::unshare();
+		nextBuffer.unshare();
+	}
+
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace(const key_type& k, Args&&... args)
+	{
+		auto ret = base::try_emplace(k, std::forward<Args>(args)...);
+		if (ret.second) nextBuffer.insert_or_assign(k, ret.first->second);
+		return ret;
+	}
+
+	size_type erase(const key_type& key)
+	{
+		nextBuffer.erase(key);
+		return base::erase(key);
+	}
+
+	void clear()
+	{
+		nextBuffer.clear();
+		base::clear();
+	}
+
+	void merge(base&& other)
+	{
+		nextBuffer.merge(base(other));
+		base::merge(std::move(other));
+		unshare();
+	}
+
+	void assign_range(const key_type& first, const key_type& last, const Value& value)
+	{
+		nextBuffer.assign_range(first, last, value);
+		base::assign_range(first, last, value);
+	}
+
+	// the values are read twice, so they need a forward iterator
+	template <typename ForwardIt>
+	void assign_values(const key_type& first, ForwardIt values, size_t count)
+	{
+		nextBuffer.assign_values(first, values, count);
+		base::assign_values(first, values, count);
+	}
+
+	template <typename K>
+	void remap_keys(const std::vector<K>& remap, K invalid_key = ~K(0))
+	{
+		nextBuffer.remap_keys(remap, invalid_key);
+		base::remap_keys(remap, invalid_key);
+	}
+
+	template <typename K>
+	void permute_keys(const std::vector<std::pair<K, K>>& moves)
+	{
+		nextBuffer.permute_keys(moves);
+		base::permute_keys(moves);
+	}
+
+	// the statistics of the read buffer, with the memory of the write buffer added in
+	segmented_map_stats memory_stats() const
+	{
+		auto ret = base::memory_stats();
+		auto nextStats = nextBuffer.memory_stats();
+
+		ret.directory_bytes += nextStats.directory_bytes;
+		ret.segments_allocated += nextStats.segments_allocated;
+		ret.segments_shared += nextStats.segments_shared;
+		ret.segment_bytes += nextStats.segment_bytes;
+		ret.empty_slot_bytes += nextStats.empty_slot_bytes;
+		ret.padding_bytes += nextStats.padding_bytes;
+		return ret;
+	}
+
+private:
+	base nextBuffer;
+};
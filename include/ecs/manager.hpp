@@ -3,19 +3,36 @@
 
 #pragma once
 
+#include <boost/core/demangle.hpp>
 #include <boost/hana.hpp>
+#include <boost/iterator/counting_iterator.hpp>
+
+#include <algorithm>
+#include <atomic>
 
 #include <bitset>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <deque>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "ecs/double_buffered_map.hpp"
 #include "ecs/misc_metafunctions.hpp"
+#include "ecs/profiler.hpp"
+#include "ecs/query_view.hpp"
 #include "ecs/segmented_map.hpp"
+#include "ecs/workload_trace.hpp"
 
 namespace ecs
 {
@@ -26,28 +43,352 @@ struct manager_data
 {
 };
 
+/// @brief Specialize this to derive from std::true_type for a storage component to double buffer
+/// it: see manager::get_next_component() and manager::flip_buffers()
+template <typename T>
+struct double_buffered : std::false_type
+{
+};
+
 /// @brief Convenience function that creates a boost::hana::tuple of boost::hana::type_c<>s from a
 /// list of types
 template <typename... T>
 constexpr auto make_type_tuple = boost::hana::make_tuple(boost::hana::type_c<T>...);
 
+/// @brief A query term (see manager::run_all_matching()) matching the entities that don't have the
+/// component \c T
+template <typename T>
+struct without
+{
+};
+
+/// @brief A query term (see manager::run_all_matching()) matching entities whether they have the
+/// storage component \c T or not. The functor gets a \c T*, null if the entity doesn't have it.
+template <typename T>
+struct optional
+{
+};
+
 namespace detail
 {
+// what a query term asks for of its component
+template <typename T>
+struct term_traits
+{
+	using component = T;
+	static constexpr bool excluded = false;
+	static constexpr bool optional = false;
+};
+template <typename T>
+struct term_traits<without<T>>
+{
+	using component = T;
+	static constexpr bool excluded = true;
+	static constexpr bool optional = false;
+};
+template <typename T>
+struct term_traits<optional<T>>
+{
+	using component = T;
+	static constexpr bool excluded = false;
+	static constexpr bool optional = true;
+};
+
+// the parameter types of the call operator of a functor, when it has a single one that isn't a
+// template (a generic lambda has none to look at)
+template <typename F, typename = void>
+struct call_parameters
+{
+	static constexpr bool known = false;
+};
+template <typename F>
+struct call_parameters<F, std::void_t<decltype(&F::operator())>>
+	: call_parameters<decltype(&F::operator())>
+{
+};
+template <typename R, typename... Args>
+struct call_parameters<R (*)(Args...)>
+{
+	static constexpr bool known = true;
+	using type = std::tuple<Args...>;
+};
+template <typename R, typename... Args>
+struct call_parameters<R (*)(Args...) noexcept> : call_parameters<R (*)(Args...)>
+{
+};
+template <typename C, typename R, typename... Args>
+struct call_parameters<R (C::*)(Args...)> : call_parameters<R (*)(Args...)>
+{
+};
+template <typename C, typename R, typename... Args>
+struct call_parameters<R (C::*)(Args...) const> : call_parameters<R (*)(Args...)>
+{
+};
+template <typename C, typename R, typename... Args>
+struct call_parameters<R (C::*)(Args...) noexcept> : call_parameters<R (*)(Args...)>
+{
+};
+template <typename C, typename R, typename... Args>
+struct call_parameters<R (C::*)(Args...) const noexcept> : call_parameters<R (*)(Args...)>
+{
+};
+
+// if the functor `F` can't write to its argument `I`: it takes it by value, by const reference or
+// by pointer to const. False when that can't be told, as for generic lambdas
+template <typename F, size_t I, typename = void>
+constexpr bool reads_argument_only = false;
+template <typename F, size_t I>
+constexpr bool reads_argument_only<
+	F, I, std::enable_if_t<(I < std::tuple_size<typename call_parameters<F>::type>::value)>> =
+	[] {
+		using P = std::tuple_element_t<I, typename call_parameters<F>::type>;
+		return (!std::is_reference<P>::value && !std::is_pointer<P>::value) ||
+			   std::is_const<std::remove_pointer_t<std::remove_reference_t<P>>>::value;
+	}();
+
+template <typename Index>
 auto removeTypeAddsegmented_map = [](auto arg) {
-	return segmented_map<size_t, typename decltype(arg)::type>{};
+	return segmented_map<Index, typename decltype(arg)::type>{};
+};
+// the storage a manager keeps a component in, keyed by entity IDs stored as `Index`
+template <typename Index>
+auto removeTypeAddStorage = [](auto arg) {
+	using T = typename decltype(arg)::type;
+	return std::conditional_t<double_buffered<T>::value, double_buffered_map<Index, T>,
+							  segmented_map<Index, T>>{};
 };
 auto removeTypeAddPtr = [](auto arg) { return (typename decltype(arg)::type*){}; };
+
+// a std::vector shared by its copies until one of them writes to it, like the segments of a
+// segmented_map, so a snapshot of the lists of entities having each component costs nothing until
+// entities get or lose the component
+template <typename T>
+class shared_vector
+{
+public:
+	const std::vector<T>& read() const { return *elements; }
+
+	// the vector, made private to this copy first if it is shared with another
+	std::vector<T>& write()
+	{
+		if (elements.use_count() > 1) elements = std::make_shared<std::vector<T>>(*elements);
+		return *elements;
+	}
+
+private:
+	std::shared_ptr<std::vector<T>> elements = std::make_shared<std::vector<T>>();
+};
 }
 
 struct manager_base
 {
 };
 
+/// @brief Checks if \c type is a boost::hana::type_c<...> of a manager
+template <typename T>
+constexpr auto ismanager(T type)
+{
+	return boost::hana::traits::is_base_of(boost::hana::type_c<manager_base>, type);
+}
+
+/// @brief The ID that no entity ever has. Used by manager::compact() for entities that are gone
+constexpr size_t invalid_entity = std::numeric_limits<size_t>::max();
+
+/// @brief How much work one call of manager::run_some_matching() may do
+struct query_budget
+{
+	/// The most entities to call the functor on. At least one matching entity is visited whatever
+	/// the budget, so a time sliced query always makes progress
+	size_t max_entities = std::numeric_limits<size_t>::max();
+	/// The longest the call may take. It is checked every few dozen entities, so it can run over
+	/// by about that many calls of the functor
+	std::chrono::nanoseconds max_time = std::chrono::nanoseconds::max();
+};
+
+/// @brief Where a time sliced query (manager::run_some_matching()) left off. Start with a default
+/// constructed one
+struct query_cursor
+{
+	/// The position of the next entity to look at in the entity table, as a (segment, slot) pair
+	size_t segment = 0;
+	size_t slot = 0;
+	/// How many full passes over the matching entities have been finished
+	size_t passes = 0;
+	/// The manager's renumber_count() the last time this was used
+	size_t renumbers = 0;
+};
+
+/// @brief A template entity to make copies of with manager::instantiate()
+template <typename Signature, typename Components>
+struct prefab
+{
+	Signature signature;
+	/// The values of the storage components in \c signature, in the same order
+	Components components;
+};
+
+/// @brief The values of one component for many entities, stored contiguously: one column of data
+/// laid out by component, for manager::create_entity_batch()
+template <typename T>
+struct column
+{
+	const T* data;
+	size_t size;
+};
+
+/// @brief Makes a column of the elements of a container storing them contiguously, like a
+/// std::vector<>
+template <typename Container>
+auto make_column(const Container& values) -> column<typename Container::value_type>
+{
+	return {values.data(), values.size()};
+}
+
+/// @brief The state of a manager hierarchy at some point, to go back to with manager::restore().
+/// See manager::snapshot()
+template <typename States>
+struct manager_snapshot
+{
+	/// The saved state of every manager, in the order of manager::all_managers
+	States states;
+	size_t next_id = 0;
+	std::vector<size_t> free_ids;
+};
+
+/// @brief The memory used by the storage of one component, see manager::memory_stats()
+struct component_memory_stats
+{
+	std::string component;
+	/// The segmented_map holding the component values. Empty for tag components
+	segmented_map_stats storage;
+	/// Bytes used by the list of entities that have the component (componentEntityStorage)
+	size_t entity_list_bytes = 0;
+	/// The part of entity_list_bytes that is reserved but unused
+	size_t entity_list_unused_bytes = 0;
+	/// Where each entity is in that list
+	segmented_map_stats entity_positions;
+
+	size_t total_bytes() const
+	{
+		return storage.total_bytes() + entity_list_bytes + entity_positions.total_bytes();
+	}
+};
+
+/// @brief The memory used by the components owned by one manager, see manager::memory_stats()
+struct manager_memory_stats
+{
+	/// One entry per component in my_components, in the same order
+	std::vector<component_memory_stats> components;
+	/// The table of entity signatures
+	segmented_map_stats signatures;
+
+	size_t total_bytes() const
+	{
+		size_t ret = signatures.total_bytes();
+		for (auto& component : components)
+			{
+				ret += component.total_bytes();
+			}
+		return ret;
+	}
+};
+
+/// @brief Hands out entity IDs. One is shared by a manager and all of its bases, so an ID means
+/// the same entity in every manager of the hierarchy.
+///
+/// An allocator with a \c parent (see manager::detach_ids()) takes its IDs from the parent
+/// \c block_size at a time instead, so it can be used on another thread than the parent.
+struct entity_id_allocator
+{
+	entity_id_allocator() = default;
+	entity_id_allocator(const entity_id_allocator&) = delete;
+	entity_id_allocator& operator=(const entity_id_allocator&) = delete;
+
+	~entity_id_allocator()
+	{
+		if (parent && block_next != block_end) root().close_block();
+	}
+
+	size_t allocate()
+	{
+		if (!free_ids.empty())
+			{
+				auto id = free_ids.back();
+				free_ids.pop_back();
+				return id;
+			}
+		if (!parent) return reserve_block(1);
+
+		if (block_next == block_end)
+			{
+				block_next = parent->reserve_block(block_size);
+				block_end = block_next + block_size;
+				root().open_block();
+			}
+		auto id = block_next++;
+		if (block_next == block_end) root().close_block();
+		return id;
+	}
+	void release(size_t id) { free_ids.push_back(id); }
+
+	/// @brief Reserves \c count new consecutive IDs and returns the first. Unlike allocate() and
+	/// release(), which must stay on the thread owning the managers, this may be called from any
+	/// thread. Throws std::length_error, and reserves nothing, when the IDs would go past
+	/// \c id_limit.
+	size_t reserve_block(size_t count)
+	{
+		if (parent) return parent->reserve_block(count);
+
+		auto first = next_id.load(std::memory_order_relaxed);
+		do
+			{
+				if (count > id_limit || first > id_limit - count)
+					throw std::length_error("Out of entity IDs; use a wider manager::index_type");
+			}
+		while (!next_id.compare_exchange_weak(first, first + count, std::memory_order_relaxed));
+		return first;
+	}
+
+	/// @brief The allocator the IDs of this one come from in the end
+	entity_id_allocator& root() { return parent ? parent->root() : *this; }
+
+	/// @brief Called on the root allocator by whatever holds a block of IDs from it (a spawner or
+	/// an allocator with a parent) when it starts taking IDs from a new block, and when it is done
+	/// with the block. Entities can't be renumbered while some blocks are still in use, or the IDs
+	/// left in them would be given out twice.
+	void open_block() { open_blocks.fetch_add(1, std::memory_order_relaxed); }
+	void close_block() { open_blocks.fetch_sub(1, std::memory_order_relaxed); }
+	bool has_open_blocks() const { return open_blocks.load(std::memory_order_relaxed) != 0; }
+
+	std::atomic<size_t> next_id{0};
+	std::vector<size_t> free_ids;
+	/// One more than the largest ID the managers sharing this can store
+	size_t id_limit = std::numeric_limits<size_t>::max();
+	std::atomic<size_t> open_blocks{0};
+
+	std::shared_ptr<entity_id_allocator> parent;
+	size_t block_size = 0;
+	size_t block_next = 0;
+	size_t block_end = 0;
+};
+
 /// @brief The core class of the library; Defines components,
-template <typename components_, typename bases_ = boost::hana::tuple<>>
+///
+/// \c Index is the type entity IDs are stored as in the component storage and the lists of which
+/// entities have which component. A \c std::uint32_t halves the memory of those lists, and of the
+/// keys walked by every query, for hierarchies that never have more than 4 billion IDs at once.
+/// Handles are \c size_t whatever it is. A manager and its bases must use the same one.
+template <typename components_, typename bases_ = boost::hana::tuple<>,
+		  typename Index = std::size_t>
 struct manager : manager_base
 {
-	static constexpr auto manager_type = boost::hana::type_c<manager<components_, bases_>>;
+	static_assert(std::is_integral<Index>::value && std::is_unsigned<Index>::value,
+				  "The index type of a manager must be an unsigned integer");
+
+	using index_type = Index;
+
+	static constexpr auto manager_type =
+		boost::hana::type_c<manager<components_, bases_, index_type>>;
 	/**
 	 * @brief Gets the list of components owned by the manager.
 	 *
@@ -149,6 +490,51 @@ struct manager : manager_base
 		return boost::hana::fold(all_components, boost::hana::make_tuple(), foldLam);
 	}();
 
+	/**
+	 * @brief Checks if \c component is accessable from this manager
+	 *
+	 * @param component A boost::hana::type_c<...>
+	 * @return A boost::hana::bool_c<...>
+	 */
+	template <typename T>
+	static constexpr auto isComponent(T component)
+	{
+		return boost::hana::contains(all_components, component);
+	}
+	/**
+	 * @brief Checks if \c component is owned by this manager
+	 */
+	template <typename T>
+	static constexpr auto isMyComponent(T component)
+	{
+		return boost::hana::contains(my_components, component);
+	}
+	/**
+	 * @brief Checks if \c component is a storage component accessable from this manager
+	 */
+	template <typename T>
+	static constexpr auto isStorageComponent(T component)
+	{
+		return boost::hana::contains(all_storage_components, component);
+	}
+	/**
+	 * @brief Checks if \c component is a tag component accessable from this manager
+	 */
+	template <typename T>
+	static constexpr auto isTagComponent(T component)
+	{
+		return boost::hana::contains(all_tag_components, component);
+	}
+	/**
+	 * @brief Checks if \c signature is a boost::hana::tuple<> of components accessable from this
+	 * manager
+	 */
+	template <typename T>
+	static constexpr auto isSignature(T signature)
+	{
+		return boost::hana::and_(is_tuple(signature), is_possible_signature(signature));
+	}
+
 	/**
 	 * @brief Gets the ID of a component type in all_components()
 	 *
@@ -171,8 +557,8 @@ struct manager : manager_base
 	template <typename T>
 	static constexpr auto get_my_component_id(T component)
 	{
-		return boost::hana::if_(isComponent(component),
-								get_index_of_first_matching(my_components(), component),
+		return boost::hana::if_(isMyComponent(component),
+								get_index_of_first_matching(my_components, component),
 								boost::hana::nothing);
 	}
 
@@ -187,7 +573,7 @@ struct manager : manager_base
 	static constexpr auto get_storage_component_id(T component)
 	{
 		return boost::hana::if_(isStorageComponent(component),
-								get_index_of_first_matching(all_storage_components(), component),
+								get_index_of_first_matching(all_storage_components, component),
 								boost::hana::nothing);
 	}
 
@@ -216,8 +602,8 @@ struct manager : manager_base
 	template <typename T>
 	static constexpr auto get_tag_component_id(T component)
 	{
-		return boost::hana::if_(isStorageComponent(component),
-								get_index_of_first_matching(all_tag_components(), component),
+		return boost::hana::if_(isTagComponent(component),
+								get_index_of_first_matching(all_tag_components, component),
 								boost::hana::nothing);
 	}
 
@@ -231,8 +617,8 @@ struct manager : manager_base
 	template <typename T>
 	static constexpr auto get_my_tag_component_id(T component)
 	{
-		return boost::hana::if_(isStorageComponent(component),
-								get_index_of_first_matching(my_storage_components, component),
+		return boost::hana::if_(isTagComponent(component),
+								get_index_of_first_matching(my_tag_components, component),
 								boost::hana::nothing);
 	}
 
@@ -319,18 +705,79 @@ struct manager : manager_base
 	template <typename T>
 	static constexpr auto isolate_my_components(T toIsolate)
 	{
-		return boost::hana::fold(
-			toIsolate, boost::hana::make_set(), [](auto toTest, auto currentSet) {
-				return boost::hana::if_(isMyComponent(toTest),
-										boost::hana::append(currentSet, toTest), currentSet);
-			});
+		return boost::hana::filter(toIsolate, [](auto toTest) { return isMyComponent(toTest); });
+	}
+	template <typename T>
+	static constexpr auto isolate_components(T toIsolate)
+	{
+		return boost::hana::filter(toIsolate, [](auto toTest) { return isComponent(toTest); });
+	}
+
+	/// @brief Gets the component a query term (a component, without<> or optional<>) is about
+	template <typename T>
+	static constexpr auto term_component(T)
+	{
+		return boost::hana::type_c<typename detail::term_traits<typename T::type>::component>;
+	}
+	/// @brief Gets the components a query requires, as a signature
+	template <typename T>
+	static constexpr auto isolate_required_terms(T query)
+	{
+		return boost::hana::filter(query, [](auto term) {
+			using traits = detail::term_traits<typename decltype(term)::type>;
+			return boost::hana::bool_c<!traits::excluded && !traits::optional>;
+		});
+	}
+	/// @brief Gets the components of the without<> terms of a query
+	template <typename T>
+	static constexpr auto isolate_excluded_terms(T query)
+	{
+		return boost::hana::transform(
+			boost::hana::filter(query,
+								[](auto term) {
+									using traits = detail::term_traits<typename decltype(term)::type>;
+									return boost::hana::bool_c<traits::excluded>;
+								}),
+			[](auto term) { return term_component(term); });
+	}
+	/// @brief Gets the terms of a query that are passed to the functor: the storage components it
+	/// requires and the optional<> terms (which are always storage components), in order
+	template <typename T>
+	static constexpr auto isolate_passed_terms(T query)
+	{
+		return boost::hana::filter(query, [](auto term) {
+			using traits = detail::term_traits<typename decltype(term)::type>;
+			return boost::hana::bool_c<
+				traits::optional ||
+				(!traits::excluded && decltype(isStorageComponent(term_component(term)))::value)>;
+		});
+	}
+
+	/**
+	 * @brief Checks if \c query is a valid query: a boost::hana::tuple<> of terms, which are either
+	 * components (required), without<component> or optional<storage component>. It has to require
+	 * at least one component.
+	 */
+	template <typename T>
+	static constexpr auto isQuery(T query)
+	{
+		auto validTerm = [](auto term) {
+			using traits = detail::term_traits<typename decltype(term)::type>;
+			return boost::hana::bool_c<
+				decltype(isComponent(term_component(term)))::value &&
+				(!traits::optional || decltype(isStorageComponent(term_component(term)))::value)>;
+		};
+		return boost::hana::bool_c<decltype(is_tuple(query))::value &&
+								   decltype(boost::hana::all_of(query, validTerm))::value &&
+								   !decltype(boost::hana::is_empty(
+									   isolate_required_terms(query)))::value>;
 	}
 
 	template <typename T>
 	static constexpr auto find_direct_base_manager_for_signature(T signature)
 	{
 		return boost::hana::fold(
-			my_bases(), boost::hana::type_c<manager>, [&signature](auto toTest, auto currentRet) {
+			my_bases, boost::hana::type_c<manager>, [&signature](auto currentRet, auto toTest) {
 				return boost::hana::if_(decltype(toTest)::type::isSignature(signature), toTest,
 										currentRet);
 			});
@@ -347,7 +794,8 @@ struct manager : manager_base
 			[&signature](auto tup) {
 				return boost::hana::make_tuple(
 					tup[1_c],
-					decltype(tup[0_c])::type::find_direct_base_manager_for_signature(signature));
+					std::decay_t<decltype(tup[1_c])>::type::find_direct_base_manager_for_signature(
+						signature));
 			});
 
 		BOOST_HANA_CONSTANT_CHECK(ismanager(ret[0_c]));
@@ -375,115 +823,1534 @@ struct manager : manager_base
 		return ret;
 	}
 
-	template <typename T, typename Components>
-	entity new_entity(T signature,
-					  Components&& components = decltype(components){} /*tuple of the components*/)
-	{
-		// TODO: implement
-	}
-
-	// returns the elements created [first, last)
-	template <typename T, typename Components>
-	std::vector<entity> create_entity_batch(T signature, Components components,
-											size_t numToConstruct)
-	{
-		// TODO: implement
-	}
-	void destroy_entity(size_t handle)
-	{
-		// TODO: implement
-	}
+	/**
+	 * @brief Gets a readable name for a call with \c signature, like "function<comp1, comp2>"
+	 */
 	template <typename T>
-	auto get_storage_component(T component, size_t handle) -> typename decltype(component)::type&
+	static std::string signature_name(const char* function, T signature)
 	{
-		// TODO: implement
+		std::string ret = function;
+		ret += '<';
+		boost::hana::for_each(signature, [&ret](auto type) {
+			if (ret.back() != '<') ret += ", ";
+			ret += boost::core::demangle(typeid(typename decltype(type)::type).name());
+		});
+		return ret + '>';
 	}
 
+	/**
+	 * @brief Creates an entity with the components in \c signature, default constructing the
+	 * storage components
+	 */
 	template <typename T>
-	bool has_component(T component, entity entity)
+	entity new_entity(T signature)
 	{
-		BOOST_HANA_CONSTANT_CHECK(isComponent(component));
+		BOOST_HANA_CONSTANT_CHECK(isSignature(signature));
 
-		constexpr auto managerForComponent = decltype(get_manager_from_component(component)){};
+		scoped_timer timer{my_profiler, [] { return "new_entity"; }};
+		timer.add_entities(1);
+
+		auto id = idAllocator->allocate();
+		add_entity_to_hierarchy(signature, id);
 
-		auto ent = getEntityPtr(managerForComponent, entity);
+		boost::hana::for_each(isolate_storage_components(signature),
+							  [this, id](auto type) { insert_storage_component(type, id); });
 
-		return ent->signature[decltype(
-			decltype(managerForComponent)::type::template get_component_id(component))::value];
+		if (recorder)
+			{
+				recorder->record(workload_op::new_entity, recorded_signature(signature));
+				recorder->created(id);
+			}
+		return make_entity(id);
 	}
 
-	template <typename T>
-	decltype(auto) get_ref_to_manager(T manager)
+	/**
+	 * @brief Creates an entity
+	 *
+	 * @param signature The components the entity has
+	 * @param components A boost::hana::tuple<> of the values of the storage components in \c
+	 * signature, in the same order. They are moved into place if it is an rvalue.
+	 */
+	template <typename T, typename Components>
+	entity new_entity(T signature, Components&& components)
 	{
-		BOOST_HANA_CONSTANT_ASSERT(boost::hana::contains(all_managers, manager));
-
-		return *basePtrStorage[get_manager_id(manager)];
+		auto ret = construct_entity(signature, std::forward<Components>(components));
+		if (recorder)
+			{
+				recorder->record(workload_op::new_entity, recorded_signature(signature));
+				recorder->created(ret.id);
+			}
+		return ret;
 	}
 
-	template <typename T>
-	auto get_component_storage(T component)
-		-> segmented_map<size_t, typename decltype(component)::type>&
+	/**
+	 * @brief Creates entities for the manager on another thread; see make_spawner()
+	 */
+	class spawner
 	{
-		BOOST_HANA_CONSTANT_CHECK(isStorageComponent(component));
-
-		constexpr auto manager = decltype(get_manager_from_component(component)){};
+	public:
+		static constexpr size_t default_block_size = 1024;
+
+		/**
+		 * @brief Stages the creation of an entity, like manager::new_entity(). The entity gets its
+		 * ID right away, but only exists in the manager after merge_spawned().
+		 *
+		 * @return The ID of the new entity
+		 */
+		template <typename T, typename Components>
+		size_t new_entity(T signature, Components&& components)
+		{
+			BOOST_HANA_CONSTANT_CHECK(isSignature(signature));
+
+			if (nextID == blockEnd)
+				{
+					nextID = allocator->reserve_block(blockSize);
+					blockEnd = nextID + blockSize;
+					allocator->root().open_block();
+				}
+			auto id = nextID++;
+			if (nextID == blockEnd) allocator->root().close_block();
+			records.emplace_back(id, generate_runtime_signature(signature));
+			if (signatureRuns.empty() || signatureRuns.back().first != &recorded_signature_of<T>)
+				{
+					signatureRuns.emplace_back(&recorded_signature_of<T>, 0);
+				}
+			++signatureRuns.back().second;
+
+			auto storageComponents = isolate_storage_components(signature);
+			static_assert(decltype(boost::hana::size(storageComponents) ==
+								   boost::hana::size(components))::value,
+						  "There must be a value for every storage component in the signature");
+
+			boost::hana::for_each(
+				boost::hana::make_range(boost::hana::size_c<0>,
+										boost::hana::size(storageComponents)),
+				[&](auto i) {
+					constexpr auto ID =
+						decltype(get_storage_component_id(storageComponents[i])){};
+					stagedComponents[ID].try_emplace(
+						id, boost::hana::at(std::forward<Components>(components), i));
+				});
+
+			return id;
+		}
+
+		template <typename T>
+		size_t new_entity(T signature)
+		{
+			auto components = boost::hana::transform(
+				isolate_storage_components(signature),
+				[](auto type) { return typename decltype(type)::type{}; });
+			return new_entity(signature, std::move(components));
+		}
+
+		/// @brief How many entities are waiting for merge_spawned()
+		size_t size() const { return records.size(); }
+
+		spawner(spawner&& other) noexcept
+			: allocator{other.allocator},
+			  blockSize{other.blockSize},
+			  nextID{other.nextID},
+			  blockEnd{other.blockEnd},
+			  records{std::move(other.records)},
+			  signatureRuns{std::move(other.signatureRuns)},
+			  stagedComponents{std::move(other.stagedComponents)}
+		{
+			// the block belongs to this one now
+			other.nextID = other.blockEnd = 0;
+		}
+		spawner& operator=(spawner&& other) noexcept
+		{
+			std::swap(allocator, other.allocator);
+			std::swap(blockSize, other.blockSize);
+			std::swap(nextID, other.nextID);
+			std::swap(blockEnd, other.blockEnd);
+			std::swap(records, other.records);
+			std::swap(signatureRuns, other.signatureRuns);
+			std::swap(stagedComponents, other.stagedComponents);
+			return *this;
+		}
+
+		// the IDs left in the block are lost until compact()
+		~spawner()
+		{
+			if (nextID != blockEnd) allocator->root().close_block();
+		}
+
+	private:
+		friend struct manager;
+
+		spawner(entity_id_allocator& allocator_, size_t blockSize_)
+			: allocator{&allocator_}, blockSize{blockSize_}
+		{
+		}
+
+		entity_id_allocator* allocator;
+		size_t blockSize;
+		size_t nextID = 0, blockEnd = 0;
+
+		std::vector<std::pair<size_t, RuntimeSignature_t>> records;
+		// the signatures of the records in order, as (how to find it in a trace, how many) runs,
+		// for merge_spawned() to record
+		std::vector<std::pair<std::uint32_t (*)(workload_recorder&), size_t>> signatureRuns;
+		decltype(boost::hana::transform(all_storage_components,
+										detail::removeTypeAddsegmented_map<index_type>))
+			stagedComponents;
+	};
 
-		const constexpr auto ID =
-			decltype(manager)::type::template get_my_stoarge_component_id(component);
+	/**
+	 * @brief Gives this manager an ID allocator of its own, which reserves IDs from the one it
+	 * shared with its bases \c blockSize at a time with one atomic add. The IDs it hands out stay
+	 * disjoint from those of the other managers sharing the bases (partitions of a
+	 * partitioned_world, for example), but it can create and destroy entities on its own thread.
+	 *
+	 * While it does, the bases are shared with the other threads, so only entities made of the
+	 * components of this manager may be created or destroyed then. Call this before making
+	 * managers derived from this one. compact(), sort_entities() and snapshot() need a manager
+	 * seeing every manager sharing its IDs, so they can't be used on this one afterwards.
+	 */
+	void detach_ids(size_t blockSize = spawner::default_block_size)
+	{
+		auto detached = std::make_shared<entity_id_allocator>();
+		detached->parent = idAllocator;
+		detached->block_size = blockSize;
+		idAllocator = std::move(detached);
+	}
 
-		return get_ref_to_manager(manager).stoarge_component_storage[ID];
+	/**
+	 * @brief Makes a spawner, which creates entities on another thread without locking: every
+	 * thread uses its own spawner. IDs are taken from the shared allocator \c blockSize at a time
+	 * with one atomic add, and the components are written to segments owned by the spawner. The
+	 * manager itself is only touched by merge_spawned(), which has to be called on the thread
+	 * owning the manager, at a sync point. The spawner must not outlive the manager.
+	 *
+	 * IDs left in a spawner's block stay reserved for its next entities; if the spawner is
+	 * destroyed they are lost until compact(). compact() and restore() throw while a spawner still
+	 * has some.
+	 */
+	spawner make_spawner(size_t blockSize = spawner::default_block_size)
+	{
+		return spawner{*idAllocator, blockSize};
 	}
 
-	// CALLING FUNCTIONS ON ENTITIES
-	template <typename T, typename F>
-	void call_function_with_signature_params(entity ent, T signature, F&& func)
+	/**
+	 * @brief Adds the entities staged in \c spawned to the manager, leaving \c spawned empty.
+	 * Component segments the manager doesn't have yet are taken over as a whole, so if every
+	 * spawner fills its own blocks of IDs, this mostly moves pointers.
+	 *
+	 * When recording the workload, the entities are recorded as made by create_entity_batch(), one
+	 * batch for every run of entities with the same signature.
+	 */
+	void merge_spawned(spawner& spawned)
 	{
-		// get components and put them in a tuple
+		scoped_timer timer{my_profiler, [] { return "merge_spawned"; }};
+		timer.add_entities(spawned.records.size());
+
+		for (const auto& record : spawned.records)
+			{
+				add_entity_to_hierarchy(record.second, record.first);
+			}
+		if (recorder)
+			{
+				auto record = spawned.records.begin();
+				for (auto [signature, count] : spawned.signatureRuns)
+					{
+						recorder->record(workload_op::create_entity_batch, signature(*recorder),
+										 count);
+						for (auto end = record + count; record != end; ++record)
+							{
+								recorder->created(record->first);
+							}
+					}
+			}
+		spawned.records.clear();
+		spawned.signatureRuns.clear();
 
-		auto components = boost::hana::fold(
-			signature, boost::hana::make_tuple(),
-			[this, ent](auto retTuple, auto nextType) -> decltype(auto) {
-				BOOST_HANA_CONSTANT_CHECK(isStorageComponent(nextType));
-				return boost::hana::append(retTuple, get_storage_component(nextType, ent));
+		boost::hana::for_each(
+			boost::hana::make_range(boost::hana::size_c<0>,
+									boost::hana::size(all_storage_components)),
+			[&](auto i) {
+				get_component_storage(all_storage_components[i])
+					.merge(std::move(spawned.stagedComponents[i]));
 			});
-
-		// expand
-		boost::hana::unpack(components, std::forward<F>(func));
 	}
 
-	template <typename T, typename F>
-	void run_all_matching(T signature, F&& functor)
+	/**
+	 * @brief Makes a prefab of the entity \c handle, copying its storage components in \c
+	 * signature (which it must have)
+	 */
+	template <typename T>
+	auto make_prefab(T signature, size_t handle)
 	{
 		BOOST_HANA_CONSTANT_CHECK(isSignature(signature));
 
-		static constexpr auto manager = decltype(find_most_base_manager_for_signature(signature)){};
-
-		get_ref_to_manager(manager).run_all_matchingIMPL(signature, std::forward<F>(functor));
+		auto components = boost::hana::transform(
+			isolate_storage_components(signature),
+			[this, handle](auto type) { return get_storage_component(type, handle); });
+		return prefab<T, decltype(components)>{signature, std::move(components)};
 	}
 
-	template <typename T, typename F>
-	void run_all_matchingIMPL(T signature, F&& functor)
+	/**
+	 * @brief Creates \c count copies of \c pf, which get consecutive new IDs. That way whole
+	 * segments are filled at once, with bulk memory copies for trivially copyable components.
+	 *
+	 * @return The ID of the first copy; the copies are [first, first + count)
+	 */
+	template <typename T, typename Components>
+	size_t instantiate(const prefab<T, Components>& pf, size_t count)
 	{
-		static_assert(manager_type == find_most_base_manager_for_signature(signature));
+		BOOST_HANA_CONSTANT_CHECK(isSignature(pf.signature));
 
+		scoped_timer timer{my_profiler, [] { return signature_name("instantiate", T{}); }};
+		timer.add_entities(count);
 
-	}
+		auto first = idAllocator->reserve_block(count);
+		for_each_recording_manager(pf.signature, [first, count](auto& man, auto signature) {
+			man.add_entity_records(first, count, signature);
+		});
 
-	manager_data<manager> my_manager_data;
+		auto storageComponents = isolate_storage_components(pf.signature);
+		boost::hana::for_each(
+			boost::hana::make_range(boost::hana::size_c<0>, boost::hana::size(storageComponents)),
+			[&](auto i) {
+				get_component_storage(storageComponents[i])
+					.assign_range(first, first + count, pf.components[i]);
+			});
 
-	// storage for the actual components
-	decltype(boost::hana::transform(my_storage_components,
-									detail::removeTypeAddsegmented_map)) stoarge_component_storage;
-	std::array<std::vector<size_t>, boost::hana::size(my_components)> componentEntityStorage;
-	decltype(boost::hana::transform(all_managers, detail::removeTypeAddPtr)) basePtrStorage;
+		if (recorder)
+			{
+				recorder->record(workload_op::instantiate, recorded_signature(pf.signature), count);
+				for (size_t id = first; id < first + count; ++id)
+					{
+						recorder->created(id);
+					}
+			}
+		return first;
+	}
 
-	manager_data<manager>& get_manager_data() { return my_manager_data; }
-	manager(const decltype(boost::hana::transform(my_bases, detail::removeTypeAddPtr)) & bases = {})
+	// returns the elements created [first, last)
+	template <typename T, typename Components>
+	std::vector<entity> create_entity_batch(T signature, Components components,
+											size_t numToConstruct)
 	{
-		using namespace boost::hana::literals;
+		scoped_timer timer{my_profiler, [] { return signature_name("create_entity_batch", T{}); }};
+		timer.add_entities(numToConstruct);
+
+		std::vector<entity> ret;
+		ret.reserve(numToConstruct);
+
+		for (size_t i = 0; i < numToConstruct; ++i)
+			{
+				ret.push_back(construct_entity(signature, components));
+			}
+
+		if (recorder)
+			{
+				recorder->record(workload_op::create_entity_batch, recorded_signature(signature),
+								 numToConstruct);
+				for (auto& made : ret)
+					{
+						recorder->created(made.id);
+					}
+			}
+		return ret;
+	}
 
-		// we don't need to assign this, it is just this!
-		auto tempBases = boost::hana::drop_back(basePtrStorage);
+	/// @brief How many entities the columnar create_entity_batch() makes between progress reports
+	static constexpr size_t bulk_load_chunk_size = 1 << 16;
+
+	/**
+	 * @brief Creates an entity for each row of \c columns, a boost::hana::tuple<> of a column<>
+	 * for every storage component in \c signature, in the same order and all of the same size.
+	 * This is for data laid out by component, like level files: the entities get consecutive IDs,
+	 * and the columns are copied to the storage a segment at a time, trivially copyable
+	 * components without looking at what the slots held.
+	 *
+	 * @param progress If set, called like `progress(done, total)` after every
+	 * bulk_load_chunk_size entities, to report the progress of large imports
+	 * @return The ID of the first entity; they are [first, first + the size of the columns)
+	 */
+	template <typename T, typename... Columns>
+	size_t create_entity_batch(T signature, const boost::hana::tuple<column<Columns>...>& columns,
+							   const std::function<void(size_t, size_t)>& progress = {})
+	{
+		BOOST_HANA_CONSTANT_CHECK(isSignature(signature));
+
+		auto storageComponents = isolate_storage_components(signature);
+		static_assert(sizeof...(Columns) > 0,
+					  "Use instantiate() to make entities without storage components");
+		static_assert(decltype(boost::hana::make_tuple(boost::hana::type_c<Columns>...) ==
+							   storageComponents)::value,
+					  "There must be a column for every storage component in the signature");
+
+		scoped_timer timer{my_profiler,
+						   [] { return signature_name("create_entity_batch", T{}); }};
+
+		size_t count = boost::hana::front(columns).size;
+		boost::hana::for_each(columns, [count](const auto& values) {
+			assert(values.size == count && "The columns must all be of the same size");
+			(void)values;
+		});
+		timer.add_entities(count);
+
+		auto first = idAllocator->reserve_block(count);
+		for_each_recording_manager(signature, [count](auto& man, auto sig) {
+			man.reserve_entity_records(count, sig);
+		});
+		for (size_t done = 0; done < count;)
+			{
+				auto chunk = std::min(bulk_load_chunk_size, count - done);
+				for_each_recording_manager(signature, [first, done, chunk](auto& man, auto sig) {
+					man.add_entity_records(first + done, chunk, sig);
+				});
+				boost::hana::for_each(
+					boost::hana::make_range(boost::hana::size_c<0>, boost::hana::size(columns)),
+					[&](auto i) {
+						get_component_storage(storageComponents[i])
+							.assign_values(first + done, columns[i].data + done, chunk);
+					});
+
+				done += chunk;
+				if (progress) progress(done, count);
+			}
+
+		if (recorder)
+			{
+				recorder->record(workload_op::create_entity_batch, recorded_signature(signature),
+								 count);
+				for (size_t id = first; id < first + count; ++id)
+					{
+						recorder->created(id);
+					}
+			}
+		return first;
+	}
+
+	/**
+	 * @brief Destroys the entity with the ID \c handle, removing it from every manager that can
+	 * see it. This should be called on the manager that created the entity (or a derived one).
+	 */
+	void destroy_entity(size_t handle)
+	{
+		if (!entitySignatures.count(handle)) return;
+
+		scoped_timer timer{my_profiler, [] { return "destroy_entity"; }};
+		timer.add_entities(1);
+		if (recorder) recorder->destroyed(handle);
+
+		boost::hana::for_each(all_managers, [this, handle](auto managerType) {
+			get_ref_to_manager(managerType).remove_entity_record(handle);
+		});
+		idAllocator->release(handle);
+	}
+	template <typename T>
+	auto get_storage_component(T component, size_t handle) -> typename decltype(component)::type&
+	{
+		BOOST_HANA_CONSTANT_CHECK(isStorageComponent(component));
+
+		return get_component_storage(component)[handle];
+	}
+
+	/**
+	 * @brief Copies \c component of the entities \c handles to \c out: \c out[i] gets the one of
+	 * \c handles[i]. Much faster than calling get_storage_component() for each of a long list of
+	 * entities, as the storage is read segment by segment whatever order the IDs are in.
+	 *
+	 * @param out A random access iterator (or pointer) to at least \c handles.size() elements
+	 */
+	template <typename T, typename OutIt>
+	void gather(T component, const std::vector<size_t>& handles, OutIt out)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isStorageComponent(component));
+
+		scoped_timer timer{my_profiler, [] {
+							   return signature_name("gather", boost::hana::make_tuple(T{}));
+						   }};
+		timer.add_entities(handles.size());
+
+		const auto& storage = get_component_storage(component);
+		storage.gather(handles, out);
+	}
+
+	/**
+	 * @brief Copies \c values[i] to \c component of the entity \c handles[i], like gather() the
+	 * other way around. Every entity must have the component already.
+	 */
+	template <typename T, typename InIt>
+	void scatter(T component, const std::vector<size_t>& handles, InIt values)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isStorageComponent(component));
+
+		scoped_timer timer{my_profiler, [] {
+							   return signature_name("scatter", boost::hana::make_tuple(T{}));
+						   }};
+		timer.add_entities(handles.size());
+
+		get_component_storage(component).scatter(handles, values);
+	}
+
+	/**
+	 * @brief Gets the value of the double buffered \c component of \c handle that will be read
+	 * after the next flip_buffers(). get_storage_component() and run_all_matching() give the one
+	 * written before the last flip, so systems writing only here and reading only there can run
+	 * in parallel, even on the same component.
+	 *
+	 * The value here is the one from the frame before the last one (the buffers are swapped, not
+	 * copied), so write every entity each frame.
+	 */
+	template <typename T>
+	auto get_next_component(T component, size_t handle) -> typename decltype(component)::type&
+	{
+		BOOST_HANA_CONSTANT_CHECK(isStorageComponent(component));
+		static_assert(double_buffered<typename decltype(component)::type>::value,
+					  "get_next_component() needs a double buffered component");
+
+		return get_component_storage(component).next()[handle];
+	}
+
+	/**
+	 * @brief Swaps the buffers of every double buffered component of this manager and its bases,
+	 * in O(1) per component. Call it between frames, when no system is running.
+	 */
+	void flip_buffers()
+	{
+		boost::hana::for_each(all_managers, [this](auto managerType) {
+			get_ref_to_manager(managerType).flip_my_buffers();
+		});
+	}
+
+	template <typename T>
+	bool has_component(T component, entity entity)
+	{
+		return has_component(component, entity.id);
+	}
+	template <typename T>
+	bool has_component(T component, size_t handle)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isComponent(component));
+
+		constexpr auto managerForComponent = decltype(get_manager_from_component(component)){};
+
+		const auto& signatures = get_ref_to_manager(managerForComponent).entitySignatures;
+		auto iter = signatures.find(handle);
+		if (iter == signatures.end()) return false;
+
+		return iter->second[decltype(
+			decltype(managerForComponent)::type::get_component_id(component))::value];
+	}
+
+	/// @brief How many entities have \c component, in O(1)
+	template <typename T>
+	size_t component_count(T component)
+	{
+		return get_entity_list(component).size();
+	}
+
+	/// @brief Called with the IDs of the entities an event happened to since the last flush
+	using component_observer = std::function<void(const std::vector<size_t>& ids)>;
+	/// @brief Called with the (old ID, new ID) pairs of the entities that were given a new ID
+	using renumber_observer =
+		std::function<void(const std::vector<std::pair<size_t, size_t>>& moves)>;
+
+	/**
+	 * @brief Registers \c func to be called from flush_observers() with the IDs of the entities
+	 * that got \c component since the last flush (as a new entity)
+	 *
+	 * @return An ID to pass to remove_observer()
+	 */
+	template <typename T, typename F>
+	size_t on_add(T component, F&& func)
+	{
+		auto& events = get_observers(component);
+		return events.added.add(events.nextObserverID++, std::forward<F>(func));
+	}
+	/**
+	 * @brief Registers \c func to be called from flush_observers() with the IDs of the entities
+	 * that lost \c component since the last flush. Their components are gone by then.
+	 */
+	template <typename T, typename F>
+	size_t on_remove(T component, F&& func)
+	{
+		auto& events = get_observers(component);
+		return events.removed.add(events.nextObserverID++, std::forward<F>(func));
+	}
+	/**
+	 * @brief Registers \c func to be called from flush_observers() with the IDs of the entities
+	 * passed to mark_changed() for \c component since the last flush
+	 */
+	template <typename T, typename F>
+	size_t on_change(T component, F&& func)
+	{
+		auto& events = get_observers(component);
+		return events.changed.add(events.nextObserverID++, std::forward<F>(func));
+	}
+	/**
+	 * @brief Registers \c func to be called by compact() and sort_entities() with the entities
+	 * they give a new ID, as (old ID, new ID) pairs. Unlike the other events, this is not kept
+	 * for the next flush: it is called as soon as the component of \c component is renumbered,
+	 * so whatever is keyed by entity ID can follow before anything else looks at it. The pairs
+	 * cover every renumbered entity, whether it has \c component or not.
+	 */
+	template <typename T, typename F>
+	size_t on_renumber(T component, F&& func)
+	{
+		auto& events = get_observers(component);
+		auto id = events.nextObserverID++;
+		events.renumbered.emplace_back(id, std::forward<F>(func));
+		return id;
+	}
+
+	/**
+	 * @brief Unregisters the observer of \c component that on_add(), on_remove(), on_change() or
+	 * on_renumber() returned \c observerID for. Events waiting for a flush are dropped once no
+	 * observer is left for them.
+	 */
+	template <typename T>
+	void remove_observer(T component, size_t observerID)
+	{
+		auto& events = get_observers(component);
+		for (auto event : {&events.added, &events.changed, &events.removed})
+			{
+				event->remove(observerID);
+			}
+
+		auto& renumbered = events.renumbered;
+		renumbered.erase(std::remove_if(renumbered.begin(), renumbered.end(),
+										[observerID](const auto& observer) {
+											return observer.first == observerID;
+										}),
+						 renumbered.end());
+	}
+
+	/**
+	 * @brief Reports that \c component of the entity \c handle was written to, for the on_change()
+	 * observers. Nothing is recorded if there are none.
+	 */
+	template <typename T>
+	void mark_changed(T component, size_t handle)
+	{
+		get_observers(component).changed.record(handle);
+	}
+
+	/**
+	 * @brief Calls the observers of this manager and its bases with the events recorded since the
+	 * last flush: for every component, first the additions, then the changes, then the removals.
+	 * An entity may be in a list more than once. Events caused by the observers themselves are
+	 * kept for the next flush.
+	 */
+	void flush_observers()
+	{
+		boost::hana::for_each(all_managers, [this](auto managerType) {
+			get_ref_to_manager(managerType).flush_my_observers();
+		});
+	}
+
+	template <typename T>
+	decltype(auto) get_ref_to_manager(T manager)
+	{
+		BOOST_HANA_CONSTANT_ASSERT(boost::hana::contains(all_managers, manager));
+
+		return *basePtrStorage[get_manager_id(manager)];
+	}
+
+	// the segmented_map of `component`, or its double_buffered_map if it is double buffered
+	template <typename T>
+	decltype(auto) get_component_storage(T component)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isStorageComponent(component));
+
+		constexpr auto manager = decltype(get_manager_from_component(component)){};
+
+		constexpr auto ID =
+			decltype(decltype(manager)::type::get_my_stoarge_component_id(component)){};
+
+		return get_ref_to_manager(manager).stoarge_component_storage[ID];
+	}
+
+	// CALLING FUNCTIONS ON ENTITIES
+	template <typename T, typename F>
+	decltype(auto) call_function_with_signature_params(entity ent, T signature, F&& func)
+	{
+		return call_function_with_signature_params(ent.id, signature, std::forward<F>(func));
+	}
+	template <typename T, typename F>
+	decltype(auto) call_function_with_signature_params(size_t handle, T signature, F&& func)
+	{
+		// get the storage components and expand them into the call
+		return boost::hana::unpack(
+			isolate_storage_components(signature), [&](auto... types) -> decltype(auto) {
+				return std::forward<F>(func)(get_storage_component(types, handle)...);
+			});
+	}
+
+	/**
+	 * @brief Calls \c functor for every entity matching the query \c query, with references to its
+	 * storage components in the order of the query.
+	 *
+	 * Besides components, which the entities must have, the query may have without<T> terms,
+	 * which the entities must not have, and optional<T> terms, for which the functor gets a T*,
+	 * null if the entity doesn't have it. Both are answered from the signature of the entity
+	 * when the components are visible from the manager owning the required ones, which is the
+	 * one walked; components of derived managers are looked up one entity at a time.
+	 */
+	template <typename T, typename F>
+	void run_all_matching(T query, F&& functor)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isQuery(query));
+
+		static constexpr auto manager =
+			decltype(find_most_base_manager_for_signature(isolate_required_terms(query))){};
+
+		if (recorder) recorder->record(workload_op::run_all_matching, recorded_signature(query));
+		get_ref_to_manager(manager).run_all_matchingIMPL(*this, query, std::forward<F>(functor));
+	}
+
+	/**
+	 * @brief Gets the entities that have all the components in \c signature as a query_view: a
+	 * random access range of tuples of references to their storage components, for the standard
+	 * (parallel) algorithms. Unlike run_all_matching() the matching entities are looked up once,
+	 * here, so the range can be split between threads.
+	 */
+	template <typename T>
+	auto query(T signature)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isSignature(signature));
+
+		scoped_timer timer{my_profiler, [] { return signature_name("query", T{}); }};
+		if (recorder) recorder->record(workload_op::query, recorded_signature(signature));
+
+		static constexpr auto manager = decltype(find_most_base_manager_for_signature(signature)){};
+		auto& owner = get_ref_to_manager(manager);
+
+		std::vector<index_type> matching;
+		auto required = owner.generate_runtime_signature(signature);
+		if (auto driver = owner.find_driver(signature))
+			{
+				matching = owner.probe_driver(*driver, required);
+			}
+		else
+			{
+				std::as_const(owner.entitySignatures)
+					.for_each([&](size_t id, const auto& entitySignature) {
+						if ((entitySignature & required) == required) matching.push_back(id);
+					});
+			}
+		timer.add_entities(matching.size());
+
+		// the components are written from several threads at once, so nothing may be left to
+		// copy on write
+		auto storages = boost::hana::transform(isolate_storage_components(signature),
+											   [this](auto type) {
+												   auto& storage = get_component_storage(type);
+												   storage.unshare();
+												   return &storage;
+											   });
+		return query_view<decltype(storages), index_type>{storages, std::move(matching)};
+	}
+
+	/**
+	 * @brief Like run_all_matching(), but stops once \c budget is used up, and picks up where it
+	 * left off (as stored in \c cursor) the next time. Meant for systems that may be spread over
+	 * several frames.
+	 *
+	 * Entities are visited in ID order, so creating or destroying entities between calls neither
+	 * skips nor repeats any of the others: new entities behind the cursor are seen in the next
+	 * pass. compact() and sort_entities() move entities around, so after one of them the cursor
+	 * starts its pass over.
+	 *
+	 * @return true if this call finished a pass over all the matching entities (the cursor then
+	 * starts from the beginning the next time)
+	 */
+	template <typename T, typename F>
+	bool run_some_matching(T signature, query_cursor& cursor, F&& functor,
+						   const query_budget& budget)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isSignature(signature));
+
+		static constexpr auto manager = decltype(find_most_base_manager_for_signature(signature)){};
+		auto& owner = get_ref_to_manager(manager);
+
+		bool timed = budget.max_time != std::chrono::nanoseconds::max();
+		if (!recorder || !timed)
+			{
+				if (recorder)
+					{
+						recorder->record(workload_op::run_some_matching,
+										 recorded_signature(signature), budget.max_entities);
+					}
+				return owner.run_some_matchingIMPL(signature, cursor, std::forward<F>(functor),
+												   budget);
+			}
+
+		// the time budget can't be replayed, so the entities visited are recorded instead
+		size_t visited = 0;
+		auto ret = owner.run_some_matchingIMPL(
+			signature, cursor,
+			[&functor, &visited](auto&... components) {
+				++visited;
+				functor(components...);
+			},
+			budget);
+		recorder->record(workload_op::run_some_matching, recorded_signature(signature), visited);
+		return ret;
+	}
+
+	template <typename T, typename F>
+	bool run_some_matchingIMPL(T signature, query_cursor& cursor, F&& functor,
+							   const query_budget& budget)
+	{
+		static_assert(manager_type == find_most_base_manager_for_signature(signature));
+
+		scoped_timer timer{my_profiler, [] { return signature_name("run_some_matching", T{}); }};
+
+		constexpr size_t segment_size = decltype(entitySignatures)::segment_size;
+		// how many entities to look at between checks of the clock
+		constexpr size_t clock_interval = 32;
+
+		if (cursor.renumbers != renumberCount)
+			{
+				cursor.segment = cursor.slot = 0;
+				cursor.renumbers = renumberCount;
+			}
+
+		auto required = generate_runtime_signature(signature);
+		constexpr auto storageComponents = decltype(isolate_storage_components(signature)){};
+		auto cursors = boost::hana::transform(
+			boost::hana::to_tuple(boost::hana::make_range(boost::hana::size_c<0>,
+														  boost::hana::size(storageComponents))),
+			[this](auto i) {
+				return term_cursor<F, decltype(i)::value>(
+					*this, std::decay_t<decltype(storageComponents[i])>{});
+			});
+
+		bool timed = budget.max_time != std::chrono::nanoseconds::max();
+		auto deadline = timed ? std::chrono::steady_clock::now() + budget.max_time
+							  : std::chrono::steady_clock::time_point{};
+
+		size_t visited = 0, looked_at = 0;
+		auto stoppedAt = std::as_const(entitySignatures).for_each_while(
+			cursor.segment * segment_size + cursor.slot,
+			[&](size_t id, const RuntimeSignature_t& entitySignature) {
+				if (visited != 0 && visited >= budget.max_entities) return false;
+				if (timed && ++looked_at % clock_interval == 0 &&
+					std::chrono::steady_clock::now() >= deadline)
+					{
+						return false;
+					}
+
+				if ((entitySignature & required) == required)
+					{
+						boost::hana::unpack(cursors, [&functor, id](auto&... cursor) {
+							functor(cursor[id]...);
+						});
+						++visited;
+					}
+				return true;
+			});
+		timer.add_entities(visited);
+
+		bool finishedPass = stoppedAt == entitySignatures.end_key();
+		if (finishedPass)
+			{
+				stoppedAt = 0;
+				++cursor.passes;
+			}
+		cursor.segment = stoppedAt / segment_size;
+		cursor.slot = stoppedAt % segment_size;
+
+		return finishedPass;
+	}
+
+	/**
+	 * @brief How many times the entities of this manager have been renumbered (by compact() or
+	 * sort_entities())
+	 */
+	size_t renumber_count() const { return renumberCount; }
+
+	// `outer` is the manager run_all_matching() was called on, which can see every component of
+	// the query
+	template <typename Outer, typename T, typename F>
+	void run_all_matchingIMPL(Outer& outer, T query, F&& functor)
+	{
+		constexpr auto signature = decltype(isolate_required_terms(query)){};
+		static_assert(manager_type == find_most_base_manager_for_signature(signature));
+
+		scoped_timer timer{my_profiler, [] { return signature_name("run_all_matching", T{}); }};
+
+		// an entity matches if (its signature & mask) == required
+		auto required = generate_runtime_signature(signature);
+		auto mask = required;
+		constexpr auto excluded = decltype(isolate_excluded_terms(query)){};
+		boost::hana::for_each(excluded, [&mask](auto type) {
+			if constexpr (decltype(isComponent(type))::value)
+				{
+					mask[decltype(get_component_id(type))::value] = true;
+				}
+		});
+		// the excluded components this manager can't see are owned by derived managers, which
+		// have to be asked
+		auto hasExcludedElsewhere = [&outer, excluded](size_t id) {
+			bool found = false;
+			boost::hana::for_each(excluded, [&](auto type) {
+				if constexpr (!decltype(isComponent(type))::value)
+					{
+						found = found || outer.has_component(type, id);
+					}
+			});
+			return found;
+		};
+
+		// walk the signatures and every component storage in lockstep: each cursor resolves its
+		// segment once
+		constexpr auto passed = decltype(isolate_passed_terms(query)){};
+		auto cursors = boost::hana::transform(
+			boost::hana::to_tuple(
+				boost::hana::make_range(boost::hana::size_c<0>, boost::hana::size(passed))),
+			[&outer](auto i) {
+				return term_cursor<F, decltype(i)::value>(outer,
+														  std::decay_t<decltype(passed[i])>{});
+			});
+		auto call = [&](size_t id, const RuntimeSignature_t& entitySignature) {
+			boost::hana::unpack(
+				boost::hana::make_range(boost::hana::size_c<0>, boost::hana::size(passed)),
+				[&](auto... i) {
+					functor(term_argument(outer, passed[i], cursors[i], id, entitySignature)...);
+				});
+		};
+
+		size_t visited = 0;
+		if (auto driver = find_driver(signature))
+			{
+				const auto& signatures = entitySignatures;
+				for (auto id : probe_driver(*driver, required, mask))
+					{
+						if (hasExcludedElsewhere(id)) continue;
+
+						call(id, signatures.at(id));
+						++visited;
+					}
+				timer.add_entities(visited);
+				return;
+			}
+
+		std::as_const(entitySignatures)
+			.for_each([&](size_t id, const RuntimeSignature_t& entitySignature) {
+				if ((entitySignature & mask) != required || hasExcludedElsewhere(id)) return;
+
+				call(id, entitySignature);
+				++visited;
+			});
+		timer.add_entities(visited);
+	}
+
+	// a cursor over the storage of the query term `term`, which is the argument `I` of a functor
+	// of type `F`: a const one if the functor can't write to it, so reading doesn't copy segments
+	// shared with a snapshot
+	template <typename F, size_t I, typename Outer, typename Term>
+	static auto term_cursor(Outer& outer, Term term)
+	{
+		auto& storage = outer.get_component_storage(term_component(term));
+		if constexpr (detail::reads_argument_only<std::decay_t<F>, I>)
+			{
+				return std::as_const(storage).make_cursor();
+			}
+		else
+			{
+				return storage.make_cursor();
+			}
+	}
+
+	// what the functor of run_all_matching() gets for the query term `term`: a reference for a
+	// required component, a pointer for an optional one
+	template <typename Outer, typename Term, typename Cursor>
+	static decltype(auto) term_argument(Outer& outer, Term term, Cursor& cursor, size_t id,
+										const RuntimeSignature_t& entitySignature)
+	{
+		if constexpr (detail::term_traits<typename Term::type>::optional)
+			{
+				constexpr auto component = decltype(term_component(term)){};
+				using component_t = typename decltype(component)::type;
+
+				bool present;
+				if constexpr (decltype(isComponent(component))::value)
+					{
+						present = entitySignature[decltype(get_component_id(component))::value];
+					}
+				else
+					{
+						present = outer.has_component(component, id);
+					}
+				return present ? &cursor[id] : static_cast<component_t*>(nullptr);
+			}
+		else
+			{
+				return cursor[id];
+			}
+	}
+
+	// how much more probing one entity costs than looking at one slot while walking the
+	// signatures, which is sequential; bench/driver_selection.cpp puts the break even point at 16
+	// to 32
+	static constexpr size_t driver_probe_cost = 16;
+
+	/**
+	 * @brief Picks how to find the entities matching \c signature: returns the list of entities
+	 * having its rarest component (the driver) if probing those is cheaper than walking the
+	 * signatures of every entity of this manager, else nullptr. With "has transform and burning",
+	 * this makes the cost O(burning entities) instead of O(entities with a transform).
+	 */
+	template <typename T>
+	const std::vector<index_type>* find_driver(T signature)
+	{
+		const std::vector<index_type>* driver = nullptr;
+		boost::hana::for_each(signature, [this, &driver](auto type) {
+			auto& entities = get_entity_list(type);
+			if (!driver || entities.size() < driver->size()) driver = &entities;
+		});
+
+		if (!driver || driver->size() * driver_probe_cost >= entitySignatures.end_key())
+			{
+				return nullptr;
+			}
+		return driver;
+	}
+
+	// the entities of `driver` that have all the components of `required`, in ID order so the
+	// component storage is still walked forward
+	std::vector<index_type> probe_driver(const std::vector<index_type>& driver,
+										 const RuntimeSignature_t& required)
+	{
+		return probe_driver(driver, required, required);
+	}
+	// the same, for the entities whose (signature & `mask`) is `required`
+	std::vector<index_type> probe_driver(const std::vector<index_type>& driver,
+										 const RuntimeSignature_t& required,
+										 const RuntimeSignature_t& mask)
+	{
+		std::vector<index_type> ret;
+		ret.reserve(driver.size());
+
+		const auto& signatures = entitySignatures;
+		for (auto id : driver)
+			{
+				auto iter = signatures.find(id);
+				if (iter != signatures.end() && (iter->second & mask) == required)
+					{
+						ret.push_back(id);
+					}
+			}
+		std::sort(ret.begin(), ret.end());
+		return ret;
+	}
+
+	// the IDs of the entities having `component`
+	template <typename T>
+	const std::vector<index_type>& get_entity_list(T component)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isComponent(component));
+
+		constexpr auto manager = decltype(get_manager_from_component(component)){};
+		constexpr auto ID = decltype(decltype(manager)::type::get_my_component_id(component))::value;
+
+		return get_ref_to_manager(manager).componentEntityStorage[ID].read();
+	}
+
+	manager_data<manager> my_manager_data;
+	profiler my_profiler;
+	workload_recorder* recorder = nullptr;
+
+	// storage for the actual components
+	decltype(boost::hana::transform(my_storage_components,
+									detail::removeTypeAddStorage<index_type>))
+		stoarge_component_storage;
+	std::array<detail::shared_vector<index_type>, boost::hana::size(my_components)>
+		componentEntityStorage;
+	// where every entity is in the lists of componentEntityStorage, so it is removed in O(1)
+	std::array<segmented_map<index_type, index_type>, boost::hana::size(my_components)>
+		componentEntityPositions;
+	decltype(boost::hana::transform(all_managers, detail::removeTypeAddPtr)) basePtrStorage;
+
+	// the signature of every entity this manager has a record of
+	segmented_map<index_type, RuntimeSignature_t> entitySignatures;
+	std::shared_ptr<entity_id_allocator> idAllocator;
+	size_t renumberCount = 0;
+
+	// the observers of one kind of event on one component, and the IDs waiting for them
+	struct observed_event
+	{
+		std::vector<component_observer> observers;
+		// the ID remove_observer() knows each of `observers` by
+		std::vector<size_t> observerIDs;
+		std::vector<size_t> pending;
+
+		void record(size_t id)
+		{
+			if (!observers.empty()) pending.push_back(id);
+		}
+
+		template <typename F>
+		size_t add(size_t observerID, F&& func)
+		{
+			observers.emplace_back(std::forward<F>(func));
+			observerIDs.push_back(observerID);
+			return observerID;
+		}
+
+		void remove(size_t observerID)
+		{
+			auto iter = std::find(observerIDs.begin(), observerIDs.end(), observerID);
+			if (iter == observerIDs.end()) return;
+
+			observers.erase(observers.begin() + (iter - observerIDs.begin()));
+			observerIDs.erase(iter);
+			if (observers.empty()) pending.clear();
+		}
+	};
+	struct component_observers
+	{
+		observed_event added, changed, removed;
+		std::vector<std::pair<size_t, renumber_observer>> renumbered;
+		size_t nextObserverID = 0;
+	};
+	std::array<component_observers, boost::hana::size(my_components)> observers;
+	std::vector<size_t> flushBuffer;
+
+	// what a snapshot() keeps of each manager
+	struct saved_state
+	{
+		decltype(stoarge_component_storage) storage;
+		decltype(componentEntityStorage) entityLists;
+		decltype(componentEntityPositions) entityPositions;
+		decltype(entitySignatures) signatures;
+	};
+
+	/**
+	 * @brief Renumbers every live entity in this manager and its bases into the dense range [0,
+	 * number of live entities), keeping their relative order, and moves the component data with
+	 * them. Meant to be run at a quiet time (load screens) after many entities have been created
+	 * and destroyed, to get rid of half empty segments.
+	 *
+	 * Every handle (and entity object) held from before is invalid afterwards; use the returned
+	 * table to fix them up. This must be called on a manager that can see every manager sharing
+	 * its entity IDs--ie. not on one of two managers sharing a base.
+	 *
+	 * Observer events still pending are flushed first, while their IDs are valid.
+	 *
+	 * @return A table indexed by the old ID, holding the new ID (or invalid_entity)
+	 * @throw std::logic_error if a spawner still has IDs left in its block, as they could be given
+	 * to renumbered entities
+	 */
+	std::vector<size_t> compact()
+	{
+		assert(size_t(idAllocator.use_count()) == boost::hana::size(all_managers) &&
+			   "compact() must be called on a manager that can see all managers sharing its IDs");
+		if (idAllocator->root().has_open_blocks())
+			{
+				throw std::logic_error("compact() while spawners hold reserved IDs");
+			}
+
+		flush_observers();
+
+		scoped_timer timer{my_profiler, [] { return "compact"; }};
+
+		// find every live entity in the hierarchy
+		std::vector<bool> live(idAllocator->next_id);
+		boost::hana::for_each(all_managers, [this, &live](auto managerType) {
+			for (auto&& record : get_ref_to_manager(managerType).entitySignatures)
+				{
+					live[record.first] = true;
+				}
+		});
+
+		std::vector<size_t> remap(live.size(), invalid_entity);
+		size_t numLive = 0;
+		for (size_t id = 0; id < live.size(); ++id)
+			{
+				if (live[id]) remap[id] = numLive++;
+			}
+
+		boost::hana::for_each(all_managers, [this, &remap](auto managerType) {
+			get_ref_to_manager(managerType).remap_entities(remap);
+		});
+
+		idAllocator->next_id = numLive;
+		idAllocator->free_ids.clear();
+
+		timer.add_entities(numLive);
+		return remap;
+	}
+
+	/**
+	 * @brief Reorders the entities that have all the components in \c signature so that their IDs
+	 * (and so their place in the storage) are sorted by the key \c key returns for them; for
+	 * example a Morton code of their position, to put entities that are close in space next to
+	 * each other in memory. The sorted entities take the IDs they had between them, so no other
+	 * entity moves.
+	 *
+	 * Entities that are already in order stay where they are, and only the ones that are out of
+	 * place are sorted and merged back in, so re-sorting after a few keys changed is cheap.
+	 *
+	 * Like compact(), this invalidates the handles of the entities that are moved, and must be
+	 * called on a manager that can see every manager sharing its entity IDs.
+	 *
+	 * @param key Called like the functor of run_all_matching(); returns something with a <.
+	 * @return The moves done, as (old ID, new ID) pairs
+	 */
+	template <typename T, typename F>
+	std::vector<std::pair<size_t, size_t>> sort_entities(T signature, F&& key)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isSignature(signature));
+		assert(size_t(idAllocator.use_count()) == boost::hana::size(all_managers) &&
+			   "sort_entities() must be called on a manager that can see all managers sharing "
+			   "its IDs");
+
+		flush_observers();
+
+		scoped_timer timer{my_profiler, [] { return signature_name("sort_entities", T{}); }};
+
+		static constexpr auto manager = decltype(find_most_base_manager_for_signature(signature)){};
+		auto& owner = get_ref_to_manager(manager);
+
+		using key_t = std::decay_t<decltype(
+			owner.call_function_with_signature_params(size_t{}, signature, key))>;
+		using keyed_entity = std::pair<key_t, size_t>;
+		auto keyLess = [](const keyed_entity& lhs, const keyed_entity& rhs) {
+			return lhs.first < rhs.first;
+		};
+
+		// split the entities (in ID order) into a sorted run and the ones that are out of place.
+		// When an entity is smaller than the last one in the run, both are taken out so a single
+		// entity with a large key can't hold up the rest of the run.
+		std::vector<size_t> slots;
+		std::vector<keyed_entity> inOrder, outOfPlace;
+
+		auto required = owner.generate_runtime_signature(signature);
+		for (auto&& record : owner.entitySignatures)
+			{
+				if ((record.second & required) != required) continue;
+
+				slots.push_back(record.first);
+				keyed_entity elem{owner.call_function_with_signature_params(record.first, signature,
+																			key),
+								  record.first};
+
+				if (!inOrder.empty() && keyLess(elem, inOrder.back()))
+					{
+						outOfPlace.push_back(std::move(inOrder.back()));
+						inOrder.pop_back();
+						outOfPlace.push_back(std::move(elem));
+					}
+				else
+					{
+						inOrder.push_back(std::move(elem));
+					}
+			}
+		timer.add_entities(slots.size());
+
+		std::stable_sort(outOfPlace.begin(), outOfPlace.end(), keyLess);
+
+		std::vector<keyed_entity> sorted;
+		sorted.reserve(slots.size());
+		std::merge(std::make_move_iterator(inOrder.begin()), std::make_move_iterator(inOrder.end()),
+				   std::make_move_iterator(outOfPlace.begin()),
+				   std::make_move_iterator(outOfPlace.end()), std::back_inserter(sorted), keyLess);
+
+		std::vector<std::pair<size_t, size_t>> moves;
+		for (size_t i = 0; i < slots.size(); ++i)
+			{
+				if (sorted[i].second != slots[i]) moves.emplace_back(sorted[i].second, slots[i]);
+			}
+
+		if (!moves.empty())
+			{
+				boost::hana::for_each(all_managers, [this, &moves](auto managerType) {
+					get_ref_to_manager(managerType).permute_entities(moves);
+				});
+			}
+		return moves;
+	}
+
+	/**
+	 * @brief Saves the entities and components of this manager and all its bases, to go back to
+	 * them later with restore(); for example to roll back a few frames of a networked game. All
+	 * of the state is copy-on-write, so this only copies segment pointers: component data is
+	 * copied a segment at a time when one side writes to it, and the list of which entities have
+	 * a component is copied whole the first time an entity gets or loses that component. Every
+	 * storage component must be copyable.
+	 *
+	 * Queries don't count as writes for the components their functor takes by value, by const
+	 * reference or by pointer to const. A generic lambda (auto&) can't be told apart from one
+	 * writing, so its components are copied as it goes.
+	 *
+	 * Observers, component indexes and the manager_data are not part of the snapshot; restore()
+	 * reports the entities it changes to the observers, so indexes catch up at the next
+	 * flush_observers(). Like compact(), this must be called on a manager that can see every
+	 * manager sharing its entity IDs.
+	 */
+	auto snapshot()
+	{
+		assert(size_t(idAllocator.use_count()) == boost::hana::size(all_managers) &&
+			   "snapshot() must be called on a manager that can see all managers sharing its IDs");
+
+		constexpr auto copyable = boost::hana::all_of(all_storage_components, [](auto type) {
+			return boost::hana::traits::is_copy_constructible(type);
+		});
+		static_assert(decltype(copyable)::value,
+					  "snapshot() needs every storage component to be copyable");
+
+		scoped_timer timer{my_profiler, [] { return "snapshot"; }};
+
+		auto states = boost::hana::transform(all_managers, [this](auto managerType) {
+			return get_ref_to_manager(managerType).save_state();
+		});
+		return manager_snapshot<decltype(states)>{
+			std::move(states), idAllocator->next_id.load(std::memory_order_relaxed),
+			idAllocator->free_ids};
+	}
+
+	/**
+	 * @brief Puts every entity and component back the way they were when \c snap was taken with
+	 * snapshot(). The snapshot is left as is, so it can be restored again.
+	 *
+	 * Handles of entities made after the snapshot are invalid afterwards, as their ID may be given
+	 * out again. Observer events still pending are dropped; instead the observers get added,
+	 * removed and changed events for the entities having each component before or after the
+	 * restore, at the next flush_observers().
+	 *
+	 * @throw std::logic_error if a spawner still has IDs left in its block, as they could be given
+	 * out again
+	 */
+	template <typename States>
+	void restore(const manager_snapshot<States>& snap)
+	{
+		assert(size_t(idAllocator.use_count()) == boost::hana::size(all_managers) &&
+			   "restore() must be called on a manager that can see all managers sharing its IDs");
+		if (idAllocator->root().has_open_blocks())
+			{
+				throw std::logic_error("restore() while spawners hold reserved IDs");
+			}
+
+		scoped_timer timer{my_profiler, [] { return "restore"; }};
+
+		auto idLimit = std::max(snap.next_id, idAllocator->next_id.load(std::memory_order_relaxed));
+		boost::hana::for_each(
+			boost::hana::make_range(boost::hana::size_c<0>, boost::hana::size(all_managers)),
+			[&](auto i) {
+				get_ref_to_manager(all_managers[i]).load_state(snap.states[i], idLimit);
+			});
+
+		idAllocator->next_id = snap.next_id;
+		idAllocator->free_ids = snap.free_ids;
+	}
+
+	/**
+	 * @brief Moves the records and components of every entity in this manager from the ID \c id
+	 * to \c remap[id]. Only used to implement compact() and friends; call those instead.
+	 */
+	void remap_entities(const std::vector<size_t>& remap)
+	{
+		++renumberCount;
+		if (recorder) recorder->remap_ids(remap, invalid_entity);
+		entitySignatures.remap_keys(remap, invalid_entity);
+		boost::hana::for_each(stoarge_component_storage, [&remap](auto& storage) {
+			storage.remap_keys(remap, invalid_entity);
+		});
+		for (auto& positions : componentEntityPositions)
+			{
+				positions.remap_keys(remap, invalid_entity);
+			}
+		for (auto& entities : componentEntityStorage)
+			{
+				for (auto& id : entities.write())
+					{
+						id = index_type(remap[id]);
+					}
+			}
+
+		if (std::all_of(observers.begin(), observers.end(),
+						[](const auto& events) { return events.renumbered.empty(); }))
+			{
+				return;
+			}
+		std::vector<std::pair<size_t, size_t>> moves;
+		for (size_t id = 0; id < remap.size(); ++id)
+			{
+				if (remap[id] != invalid_entity && remap[id] != id)
+					{
+						moves.emplace_back(id, remap[id]);
+					}
+			}
+		notify_renumbered(moves);
+	}
+
+	// calls the on_renumber() observers of every component of this manager
+	void notify_renumbered(const std::vector<std::pair<size_t, size_t>>& moves)
+	{
+		for (auto& events : observers)
+			{
+				for (auto& observer : events.renumbered)
+					{
+						observer.second(moves);
+					}
+			}
+	}
+
+	/**
+	 * @brief Moves the records and components of the entities in \c moves, given as (old ID, new
+	 * ID) pairs. Only used to implement sort_entities(); call that instead.
+	 */
+	void permute_entities(const std::vector<std::pair<size_t, size_t>>& moves)
+	{
+		++renumberCount;
+		if (recorder) recorder->move_ids(moves);
+		entitySignatures.permute_keys(moves);
+		boost::hana::for_each(stoarge_component_storage,
+							  [&moves](auto& storage) { storage.permute_keys(moves); });
+
+		// the entities keep their place in the lists, which now hold their new IDs
+		for (size_t i = 0; i < componentEntityStorage.size(); ++i)
+			{
+				auto& positions = componentEntityPositions[i];
+				positions.permute_keys(moves);
+				for (auto& move : moves)
+					{
+						auto iter = positions.find(move.second);
+						if (iter != positions.end())
+							{
+								componentEntityStorage[i].write()[iter->second] =
+									index_type(move.second);
+							}
+					}
+			}
+
+		notify_renumbered(moves);
+	}
+
+	/**
+	 * @brief The state of this manager alone. Only used to implement snapshot(); call that
+	 * instead.
+	 */
+	saved_state save_state()
+	{
+		saved_state ret{stoarge_component_storage, componentEntityStorage,
+						componentEntityPositions, entitySignatures};
+		// double buffered components are written from several threads at once, which sharing
+		// segments with the snapshot would make unsafe. They are usually all written every frame,
+		// so the copies would be made anyway.
+		for_each_double_buffered_storage([](auto& storage) { storage.unshare(); });
+		return ret;
+	}
+
+	/**
+	 * @brief Puts this manager back in \c saved. Only used to implement restore(); call that
+	 * instead.
+	 */
+	void load_state(const saved_state& saved, size_t idLimit)
+	{
+		++renumberCount;
+
+		// the pending events are about entities that are being rolled back; instead tell the
+		// observers about every entity having the component on either side
+		std::vector<char> had;
+		for (size_t i = 0; i < observers.size(); ++i)
+			{
+				auto& events = observers[i];
+				for (auto event : {&events.added, &events.changed, &events.removed})
+					{
+						event->pending.clear();
+					}
+				if (events.added.observers.empty() && events.changed.observers.empty() &&
+					events.removed.observers.empty())
+					{
+						continue;
+					}
+
+				had.resize(idLimit);
+				for (auto id : componentEntityStorage[i].read())
+					{
+						had[id] = true;
+					}
+				for (auto id : saved.entityLists[i].read())
+					{
+						if (had[id])
+							{
+								events.changed.record(id);
+								had[id] = false;
+							}
+						else
+							{
+								events.added.record(id);
+							}
+					}
+				for (auto id : componentEntityStorage[i].read())
+					{
+						if (had[id]) events.removed.record(id);
+						had[id] = false;
+					}
+			}
+
+		stoarge_component_storage = saved.storage;
+		componentEntityStorage = saved.entityLists;
+		componentEntityPositions = saved.entityPositions;
+		entitySignatures = saved.signatures;
+		for_each_double_buffered_storage([](auto& storage) { storage.unshare(); });
+	}
+
+	/**
+	 * @brief Gathers memory statistics for every component owned by this manager (base managers
+	 * report their own). This walks every allocated segment, so it is not meant for hot paths.
+	 */
+	manager_memory_stats memory_stats() const
+	{
+		manager_memory_stats ret;
+		ret.signatures = entitySignatures.memory_stats();
+
+		boost::hana::for_each(my_components, [this, &ret](auto type) {
+			component_memory_stats stats;
+			stats.component = boost::core::demangle(typeid(typename decltype(type)::type).name());
+
+			const auto& entities =
+				componentEntityStorage[decltype(get_my_component_id(type))::value].read();
+			stats.entity_list_bytes = entities.capacity() * sizeof(index_type);
+			stats.entity_list_unused_bytes =
+				(entities.capacity() - entities.size()) * sizeof(index_type);
+			stats.entity_positions =
+				componentEntityPositions[decltype(get_my_component_id(type))::value]
+					.memory_stats();
+
+			if constexpr (decltype(isStorageComponent(type))::value)
+				{
+					constexpr auto ID = decltype(get_my_stoarge_component_id(type)){};
+					stats.storage = stoarge_component_storage[ID].memory_stats();
+				}
+
+			ret.components.push_back(std::move(stats));
+		});
+
+		return ret;
+	}
+
+	manager_data<manager>& get_manager_data() { return my_manager_data; }
+	profiler& get_profiler() { return my_profiler; }
+
+	/**
+	 * @brief Starts recording the calls made on this manager to \c rec, or stops if it is null.
+	 * See workload_recorder and replay_workload()
+	 */
+	void record_workload(workload_recorder* rec) { recorder = rec; }
+	manager(const decltype(boost::hana::transform(my_bases, detail::removeTypeAddPtr)) & bases = {})
+	{
+		using namespace boost::hana::literals;
+
+		constexpr auto sameIndex = boost::hana::all_of(my_bases, [](auto base) {
+			return boost::hana::bool_c<
+				std::is_same<typename decltype(base)::type::index_type, index_type>::value>;
+		});
+		static_assert(decltype(sameIndex)::value,
+					  "A manager must use the same index type as its bases");
+
+		// we don't need to assign this, it is just this!
+		auto tempBases = boost::hana::drop_back(basePtrStorage);
 
 		boost::hana::for_each(tempBases, [&bases](auto& baseToSet) {
 
@@ -519,15 +2386,306 @@ struct manager : manager_base
 		});
 
 		basePtrStorage = boost::hana::append(tempBases, this);
+
+		// share the ID allocator of the most base manager so IDs are unique in the hierarchy
+		if constexpr (decltype(boost::hana::is_empty(my_bases))::value)
+			{
+				idAllocator = std::make_shared<entity_id_allocator>();
+				idAllocator->id_limit = std::numeric_limits<index_type>::max();
+			}
+		else
+			{
+				idAllocator = boost::hana::front(basePtrStorage)->idAllocator;
+			}
+	}
+
+	// events still pending are dropped: the observers may be gone already, so flush_observers()
+	// before destroying a manager if they matter
+	~manager() {}
+
+	template <typename T>
+	auto& get_observers(T component)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isComponent(component));
+
+		constexpr auto manager = decltype(get_manager_from_component(component)){};
+		constexpr auto ID = decltype(decltype(manager)::type::get_my_component_id(component)){};
+
+		return get_ref_to_manager(manager).observers[ID];
+	}
+
+	void flush_my_observers()
+	{
+		scoped_timer timer{my_profiler, [] { return "flush_observers"; }};
+
+		// swapping keeps the buffers around, so flushing doesn't allocate once they're big enough
+		auto& ids = flushBuffer;
+		for (auto& component : observers)
+			{
+				for (auto event : {&component.added, &component.changed, &component.removed})
+					{
+						if (event->pending.empty()) continue;
+
+						ids.swap(event->pending);
+						timer.add_entities(ids.size());
+						for (size_t i = 0; i < event->observers.size(); ++i)
+							{
+								event->observers[i](ids);
+							}
+						ids.clear();
+					}
+			}
 	}
 
-	~manager()
+	void flip_my_buffers()
 	{
-		// TODO: add callbacks
+		for_each_double_buffered_storage([](auto& storage) { storage.flip(); });
+	}
+
+	// calls `func(storage)` for the double_buffered_map of every double buffered component owned
+	// by this manager
+	template <typename F>
+	void for_each_double_buffered_storage(F&& func)
+	{
+		boost::hana::for_each(my_storage_components, [this, &func](auto type) {
+			if constexpr (double_buffered<typename decltype(type)::type>::value)
+				{
+					constexpr auto ID = decltype(get_my_stoarge_component_id(type)){};
+					func(stoarge_component_storage[ID]);
+				}
+		});
+	}
+
+	// new_entity(), without recording it
+	template <typename T, typename Components>
+	entity construct_entity(T signature, Components&& components)
+	{
+		BOOST_HANA_CONSTANT_CHECK(isSignature(signature));
+
+		scoped_timer timer{my_profiler, [] { return "new_entity"; }};
+		timer.add_entities(1);
+
+		auto id = idAllocator->allocate();
+		add_entity_to_hierarchy(signature, id);
+
+		auto storageComponents = isolate_storage_components(signature);
+		static_assert(decltype(boost::hana::size(storageComponents) ==
+							   boost::hana::size(components))::value,
+					  "There must be a value for every storage component in the signature");
+
+		boost::hana::for_each(
+			boost::hana::make_range(boost::hana::size_c<0>, boost::hana::size(storageComponents)),
+			[&](auto i) {
+				insert_storage_component(
+					storageComponents[i], id,
+					boost::hana::at(std::forward<Components>(components), i));
+			});
+
+		return make_entity(id);
+	}
+
+	entity make_entity(size_t id)
+	{
+		return {id, [this, id] { destroy_entity(id); }};
+	}
+
+	// the index of `signature` in the trace being recorded
+	template <typename T>
+	std::uint32_t recorded_signature(T)
+	{
+		return recorded_signature_of<T>(*recorder);
+	}
+
+	// the same in the trace of `rec`, for spawners, which don't know if the manager is recording
+	template <typename T>
+	static std::uint32_t recorded_signature_of(workload_recorder& rec)
+	{
+		return rec.signature_id([] { return signature_name("", T{}); });
+	}
+
+	// calls `func(manager, signature as seen by it)` for every manager in the hierarchy that keeps
+	// a record of entities with `signature`: those owning one of its components, and always this
+	// one
+	template <typename T, typename F>
+	void for_each_recording_manager(T, F&& func)
+	{
+		boost::hana::for_each(all_managers, [this, &func](auto managerType) {
+			using other_t = typename decltype(managerType)::type;
+
+			constexpr bool isThis = decltype(managerType == manager_type)::value;
+			constexpr bool ownsComponent =
+				!decltype(boost::hana::is_empty(other_t::isolate_my_components(T{})))::value;
+
+			if constexpr (isThis || ownsComponent)
+				{
+					func(get_ref_to_manager(managerType), other_t::isolate_components(T{}));
+				}
+		});
+	}
+
+	// adds the record of a new entity to every manager in the hierarchy that owns one of its
+	// components (and always to this manager)
+	template <typename T>
+	void add_entity_to_hierarchy(T signature, size_t id)
+	{
+		for_each_recording_manager(signature, [id](auto& man, auto signature) {
+			man.add_entity_record(id, signature);
+		});
+	}
+
+	// the same, for a signature only known at runtime
+	void add_entity_to_hierarchy(const RuntimeSignature_t& signature, size_t id)
+	{
+		boost::hana::for_each(all_managers, [this, id, &signature](auto managerType) {
+			using other_t = typename decltype(managerType)::type;
+
+			typename other_t::RuntimeSignature_t otherSignature;
+			bool ownsComponent = false;
+			boost::hana::for_each(other_t::all_components, [&](auto type) {
+				if (!signature[decltype(get_component_id(type))::value]) return;
+
+				otherSignature[decltype(other_t::get_component_id(type))::value] = true;
+				ownsComponent = ownsComponent || decltype(other_t::isMyComponent(type))::value;
+			});
+
+			if (decltype(managerType == manager_type)::value || ownsComponent)
+				{
+					get_ref_to_manager(managerType).add_entity_record(id, otherSignature);
+				}
+		});
+	}
+
+	// constructs `component` of the entity `id` in place from `args`
+	template <typename T, typename... Args>
+	void insert_storage_component(T component, size_t id, Args&&... args)
+	{
+		auto& storage = get_component_storage(component);
+
+		if constexpr (profiler::enabled)
+			{
+				if (!storage.has_segment_for(id))
+					{
+						scoped_timer timer{my_profiler, [] {
+											   return signature_name("storage_growth",
+																	 boost::hana::make_tuple(T{}));
+										   }};
+						storage.try_emplace(id, std::forward<Args>(args)...);
+						return;
+					}
+			}
+		storage.try_emplace(id, std::forward<Args>(args)...);
+	}
+
+	template <typename T>
+	void add_entity_record(size_t id, T signature)
+	{
+		entitySignatures.insert({id, generate_runtime_signature(signature)});
+
+		boost::hana::for_each(isolate_my_components(signature), [this, id](auto type) {
+			constexpr auto ID = decltype(get_my_component_id(type))::value;
+			push_entity(ID, id);
+			observers[ID].added.record(id);
+		});
+	}
+
+	// the same, for the entities [first, first + count)
+	template <typename T>
+	void add_entity_records(size_t first, size_t count, T signature)
+	{
+		entitySignatures.assign_range(first, first + count, generate_runtime_signature(signature));
+
+		boost::hana::for_each(isolate_my_components(signature), [&](auto type) {
+			constexpr auto ID = decltype(get_my_component_id(type))::value;
+
+			auto& entities = componentEntityStorage[ID].write();
+			componentEntityPositions[ID].assign_values(
+				first, boost::counting_iterator<index_type>(index_type(entities.size())), count);
+			entities.resize(entities.size() + count);
+			std::iota(entities.end() - count, entities.end(), first);
+			if (!observers[ID].added.observers.empty())
+				{
+					for (size_t id = first; id < first + count; ++id)
+						{
+							observers[ID].added.record(id);
+						}
+				}
+		});
+	}
+
+	// makes room in the entity lists for `count` more entities with `signature`
+	template <typename T>
+	void reserve_entity_records(size_t count, T signature)
+	{
+		boost::hana::for_each(isolate_my_components(signature), [this, count](auto type) {
+			auto& entities =
+				componentEntityStorage[decltype(get_my_component_id(type))::value].write();
+			entities.reserve(entities.size() + count);
+		});
+	}
+
+	void add_entity_record(size_t id, const RuntimeSignature_t& signature)
+	{
+		entitySignatures.insert({id, signature});
+
+		boost::hana::for_each(my_components, [this, id, &signature](auto type) {
+			if (!signature[decltype(get_component_id(type))::value]) return;
+
+			constexpr auto ID = decltype(get_my_component_id(type))::value;
+			push_entity(ID, id);
+			observers[ID].added.record(id);
+		});
+	}
+
+	// adds `id` to the list of entities having the component `componentID` of this manager
+	void push_entity(size_t componentID, size_t id)
+	{
+		auto& entities = componentEntityStorage[componentID].write();
+		componentEntityPositions[componentID].insert({id, index_type(entities.size())});
+		entities.push_back(id);
+	}
+
+	// swaps the last entity of the list into the place of `id`
+	void erase_entity(size_t componentID, size_t id)
+	{
+		auto& entities = componentEntityStorage[componentID].write();
+		auto& positions = componentEntityPositions[componentID];
+
+		auto position = positions.at(id);
+		auto last = entities.back();
+		entities[position] = last;
+		positions.at(last) = position;
+		entities.pop_back();
+		positions.erase(id);
+	}
+
+	void remove_entity_record(size_t id)
+	{
+		if (!entitySignatures.count(id)) return;
+
+		auto signature = entitySignatures[id];
+		boost::hana::for_each(my_components, [this, id, &signature](auto type) {
+			if (!signature[decltype(get_component_id(type))::value]) return;
+
+			constexpr auto ID = decltype(get_my_component_id(type))::value;
+			erase_entity(ID, id);
+			observers[ID].removed.record(id);
+
+			if constexpr (decltype(isStorageComponent(type))::value)
+				{
+					get_component_storage(type).erase(id);
+				}
+		});
+		entitySignatures.erase(id);
 	}
 };
 
-template <typename Types, typename Bases = decltype(boost::hana::make_tuple())>
+/**
+ * @brief Makes a manager owning the components \c T, deriving from the managers pointed to by
+ * \c bases. The entity IDs are stored as \c Index (see manager); by default the type the bases
+ * use, or size_t: `create_manager<std::uint32_t>(make_type_tuple<position>)`.
+ */
+template <typename Index = void, typename Types,
+		  typename Bases = decltype(boost::hana::make_tuple())>
 auto create_manager(Types T, const Bases& bases = {})
 {
 	auto ismanagerptr = [](auto elem) {
@@ -544,6 +2702,14 @@ auto create_manager(Types T, const Bases& bases = {})
 		return boost::hana::type_c<std::remove_pointer_t<decltype(elem)>>;
 	});
 
-	return manager<Types, decltype(bases_noptr)>(bases);
+	auto baseIndex = boost::hana::fold(bases_noptr, boost::hana::type_c<std::size_t>,
+									   [](auto, auto base) {
+										   using base_t = typename decltype(base)::type;
+										   return boost::hana::type_c<typename base_t::index_type>;
+									   });
+	using index = std::conditional_t<std::is_void<Index>::value,
+									 typename decltype(baseIndex)::type, Index>;
+
+	return manager<Types, decltype(bases_noptr), index>(bases);
 }
 }
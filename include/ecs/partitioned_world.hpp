@@ -0,0 +1,364 @@
+/// @brief This defines partitioned_world, which splits a world into managers run on their own
+/// threads, and the queues they talk through
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ecs/manager.hpp"
+
+namespace ecs
+{
+/**
+ * @brief An unbounded lock-free queue with one producer thread and one consumer thread. Elements
+ * are stored in blocks of \c BlockSize, so there is one allocation per block rather than per
+ * element.
+ */
+template <typename T, size_t BlockSize = 256>
+class spsc_queue
+{
+public:
+	spsc_queue() : head{new block}, tail{head} {}
+	spsc_queue(const spsc_queue&) = delete;
+	spsc_queue& operator=(const spsc_queue&) = delete;
+
+	~spsc_queue()
+	{
+		while (head)
+			{
+				delete std::exchange(head, head->next.load(std::memory_order_relaxed));
+			}
+	}
+
+	/// @brief Adds \c value at the back. Only to be called from the producer thread
+	void push(T value)
+	{
+		if (tailIndex == BlockSize)
+			{
+				auto next = new block;
+				tail->next.store(next, std::memory_order_release);
+				tail = next;
+				tailIndex = 0;
+			}
+		tail->items[tailIndex] = std::move(value);
+		tail->written.store(++tailIndex, std::memory_order_release);
+	}
+
+	/// @brief Moves the front element to \c value, if there is one. Only to be called from the
+	/// consumer thread
+	bool try_pop(T& value)
+	{
+		if (headIndex == BlockSize)
+			{
+				auto next = head->next.load(std::memory_order_acquire);
+				if (!next) return false;
+
+				delete std::exchange(head, next);
+				headIndex = 0;
+			}
+		if (headIndex == head->written.load(std::memory_order_acquire)) return false;
+
+		value = std::move(head->items[headIndex++]);
+		return true;
+	}
+
+private:
+	struct block
+	{
+		std::array<T, BlockSize> items;
+		// how many of the items the producer has written
+		std::atomic<size_t> written{0};
+		std::atomic<block*> next{nullptr};
+	};
+
+	// the consumer's side
+	block* head;
+	size_t headIndex = 0;
+
+	// the producer's side, on another cache line so the two threads don't fight over it
+	alignas(64) block* tail;
+	size_t tailIndex = 0;
+};
+
+/**
+ * @brief Splits one world into \c size() managers of the type \c Partition (for example one per
+ * spatial region), each run on a thread of its own, which lives as long as the world. The
+ * partitions may share base managers, which
+ * hold the data everyone reads and must not be written while the partitions run. Each partition
+ * takes its entity IDs from the shared allocator a block at a time (see manager::detach_ids()),
+ * so IDs are unique across the world.
+ *
+ * Partitions talk through messages: every ordered pair of partitions has its own spsc_queue, so
+ * sending and receiving never lock, and the queues of a receiver together make a
+ * multiple-producer inbox. Messages are handled at the receiver's next drain(), and so are
+ * entities moved with migrate().
+ */
+template <typename Partition, typename Message>
+class partitioned_world
+{
+public:
+	/**
+	 * @brief Makes \c count partitions derived from the managers in \c bases (a
+	 * boost::hana::tuple<> of pointers, like for create_manager())
+	 */
+	template <typename Bases = decltype(boost::hana::make_tuple())>
+	explicit partitioned_world(size_t count, const Bases& bases = {},
+							   size_t idBlockSize = Partition::spawner::default_block_size)
+		: queues(count * count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			{
+				partitions.push_back(std::make_unique<Partition>(bases));
+				partitions.back()->detach_ids(idBlockSize);
+			}
+		for (auto& queue : queues)
+			{
+				queue = std::make_unique<spsc_queue<envelope>>();
+			}
+
+		exceptions.resize(count);
+		try
+			{
+				for (size_t i = 0; i < count; ++i)
+					{
+						// the vector may grow under the threads started before, so they are given
+						// their worker directly
+						auto& self = *workers.emplace_back(std::make_unique<worker>());
+						self.thread = std::thread{[this, &self, i] { work(self, i); }};
+					}
+			}
+		catch (...)
+			{
+				stop_workers();
+				throw;
+			}
+	}
+
+	partitioned_world(const partitioned_world&) = delete;
+	partitioned_world& operator=(const partitioned_world&) = delete;
+
+	~partitioned_world() { stop_workers(); }
+
+	size_t size() const { return partitions.size(); }
+	Partition& operator[](size_t i) { return *partitions[i]; }
+
+	/// @brief Sends \c message from the partition \c from to \c to. Call it on \c from's thread
+	void send(size_t from, size_t to, Message message)
+	{
+		queue(from, to).push(envelope{std::move(message), {}});
+	}
+
+	/**
+	 * @brief Moves the entity \c id with the components in \c signature, which must all be
+	 * components of the partitions, from the partition \c from to \c to. It is destroyed right
+	 * away, and made again (with a new ID) in \c to at its next drain(). Call it on \c from's
+	 * thread.
+	 */
+	template <typename T>
+	void migrate(size_t from, size_t to, size_t id, T signature)
+	{
+		static_assert(decltype(boost::hana::size(Partition::isolate_my_components(signature)) ==
+							   boost::hana::size(signature))::value,
+					  "Only components of the partitions can be migrated, the bases are shared");
+
+		auto& source = *partitions[from];
+		auto components =
+			boost::hana::transform(Partition::isolate_storage_components(signature),
+								   [&source, id](auto type) {
+									   return std::move(source.get_storage_component(type, id));
+								   });
+		source.destroy_entity(id);
+
+		queue(from, to).push(envelope{
+			{}, std::make_unique<migration<T, decltype(components)>>(signature,
+																	 std::move(components))});
+	}
+
+	/**
+	 * @brief Makes the entities migrated to the partition \c to, then calls
+	 * `handler(from, message)` for every message sent to it, in the order each sender sent them.
+	 * Call it on \c to's thread.
+	 *
+	 * @return How many messages and migrations there were
+	 */
+	template <typename F>
+	size_t drain(size_t to, F&& handler)
+	{
+		size_t drained = 0;
+		envelope received;
+		for (size_t from = 0; from < size(); ++from)
+			{
+				auto& inbox = queue(from, to);
+				while (inbox.try_pop(received))
+					{
+						if (received.migration)
+							{
+								received.migration->make(*partitions[to]);
+							}
+						else
+							{
+								handler(from, std::move(received.message));
+							}
+						++drained;
+					}
+			}
+		return drained;
+	}
+
+	/**
+	 * @brief Calls `func(index, partition)` for every partition, each on the thread of the
+	 * partition, and returns once they are all done. An exception thrown by one of them is
+	 * rethrown here. Call it from one thread at a time, and not from the partitions' threads.
+	 */
+	template <typename F>
+	void run_parallel(F&& func)
+	{
+		auto job = [&func](size_t i, Partition& partition) { func(i, partition); };
+		using job_type = decltype(job);
+		task next{&job, [](void* function, size_t i, Partition& partition) {
+					  (*static_cast<job_type*>(function))(i, partition);
+				  }};
+
+		running = size();
+		for (auto& worker : workers)
+			{
+				worker->push(next);
+			}
+		{
+			std::unique_lock<std::mutex> lock{doneMutex};
+			allDone.wait(lock, [this] { return running == 0; });
+		}
+
+		std::exception_ptr first;
+		for (auto& exception : exceptions)
+			{
+				if (!first) first = exception;
+				exception = nullptr;
+			}
+		if (first) std::rethrow_exception(first);
+	}
+
+private:
+	// a migrated entity, made again in the receiver
+	struct migration_base
+	{
+		virtual ~migration_base() = default;
+		virtual void make(Partition& target) = 0;
+	};
+
+	template <typename T, typename Components>
+	struct migration final : migration_base
+	{
+		migration(T signature_, Components&& components_)
+			: signature{signature_}, components{std::move(components_)}
+		{
+		}
+
+		void make(Partition& target) override
+		{
+			target.new_entity(signature, std::move(components));
+		}
+
+		T signature;
+		Components components;
+	};
+
+	struct envelope
+	{
+		Message message;
+		// null for messages
+		std::unique_ptr<migration_base> migration;
+	};
+
+	// a call of run_parallel() for a worker to make; the one without a function stops it
+	struct task
+	{
+		void* job = nullptr;
+		void (*call)(void* function, size_t i, Partition& partition) = nullptr;
+	};
+
+	// the thread of a partition, which sleeps until it is given a task
+	struct worker
+	{
+		void push(const task& next)
+		{
+			tasks.push(next);
+			{
+				std::lock_guard<std::mutex> lock{mutex};
+				++pending;
+			}
+			wake.notify_one();
+		}
+
+		task pop()
+		{
+			{
+				std::unique_lock<std::mutex> lock{mutex};
+				wake.wait(lock, [this] { return pending != 0; });
+				--pending;
+			}
+			task ret;
+			tasks.try_pop(ret);
+			return ret;
+		}
+
+		spsc_queue<task, 16> tasks;
+		std::mutex mutex;
+		std::condition_variable wake;
+		// how many tasks were pushed but not popped yet
+		size_t pending = 0;
+		std::thread thread;
+	};
+
+	void work(worker& self, size_t i)
+	{
+		for (auto next = self.pop(); next.call; next = self.pop())
+			{
+				try
+					{
+						next.call(next.job, i, *partitions[i]);
+					}
+				catch (...)
+					{
+						exceptions[i] = std::current_exception();
+					}
+
+				std::lock_guard<std::mutex> lock{doneMutex};
+				if (--running == 0) allDone.notify_one();
+			}
+	}
+
+	void stop_workers()
+	{
+		for (auto& worker : workers)
+			{
+				if (!worker->thread.joinable()) continue;
+
+				worker->push(task{});
+				worker->thread.join();
+			}
+	}
+
+	spsc_queue<envelope>& queue(size_t from, size_t to) { return *queues[from * size() + to]; }
+
+	std::vector<std::unique_ptr<Partition>> partitions;
+	std::vector<std::unique_ptr<spsc_queue<envelope>>> queues;
+
+	std::vector<std::unique_ptr<worker>> workers;
+	// what the workers threw in the current run_parallel(), by partition
+	std::vector<std::exception_ptr> exceptions;
+	// how many workers are still running the current run_parallel()
+	size_t running = 0;
+	std::mutex doneMutex;
+	std::condition_variable allDone;
+};
+}
@@ -0,0 +1,205 @@
+/// @brief This defines perf_counter_group, which reads the hardware performance counters of a
+/// thread through Linux's perf_event_open
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+namespace ecs
+{
+/// @brief The events a perf_counter_group counts
+enum class hardware_counter
+{
+	cycles,
+	instructions,
+	/// Reads missing the L1 data cache
+	l1d_read_misses,
+	/// Reads missing the last level cache, so going to memory
+	llc_read_misses,
+	branch_misses,
+	/// How long the thread was running, in nanoseconds (a software event, so always there)
+	task_clock,
+	count
+};
+
+/// @brief The name of \c counter, like "llc_read_misses"
+inline const char* hardware_counter_name(hardware_counter counter)
+{
+	static const char* const names[] = {"cycles",		   "instructions",  "l1d_read_misses",
+										"llc_read_misses", "branch_misses", "task_clock"};
+	return names[size_t(counter)];
+}
+
+/// @brief A value for every hardware_counter
+struct hardware_counters
+{
+	std::array<std::uint64_t, size_t(hardware_counter::count)> values{};
+
+	std::uint64_t& operator[](hardware_counter counter) { return values[size_t(counter)]; }
+	std::uint64_t operator[](hardware_counter counter) const { return values[size_t(counter)]; }
+
+	hardware_counters& operator+=(const hardware_counters& other)
+	{
+		for (size_t i = 0; i < values.size(); ++i)
+			{
+				values[i] += other.values[i];
+			}
+		return *this;
+	}
+
+	// the counts between two reads
+	hardware_counters operator-(const hardware_counters& earlier) const
+	{
+		hardware_counters ret;
+		for (size_t i = 0; i < values.size(); ++i)
+			{
+				ret.values[i] = values[i] - earlier.values[i];
+			}
+		return ret;
+	}
+
+	double instructions_per_cycle() const
+	{
+		auto cycles = (*this)[hardware_counter::cycles];
+		return cycles ? double((*this)[hardware_counter::instructions]) / double(cycles) : 0.0;
+	}
+};
+
+/**
+ * @brief The performance counters of the thread constructing it, opened as one group so they
+ * are read together with one system call. Counters the CPU or the kernel doesn't give (in a VM,
+ * or with a strict kernel.perf_event_paranoid) are left out and read as 0; see supported(). Only
+ * user space is counted. Not available on other systems than Linux.
+ */
+class perf_counter_group
+{
+public:
+	perf_counter_group()
+	{
+#ifdef __linux__
+		fds.fill(-1);
+		for (size_t i = 0; i < fds.size(); ++i)
+			{
+				perf_event_attr attr;
+				std::memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+								   PERF_FORMAT_TOTAL_TIME_RUNNING;
+				set_event(hardware_counter(i), attr);
+
+				// the first counter that opens leads the group
+				fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+				if (fds[i] < 0) continue;
+
+				if (leader < 0) leader = fds[i];
+				order[opened++] = hardware_counter(i);
+			}
+#endif
+	}
+	perf_counter_group(const perf_counter_group&) = delete;
+	perf_counter_group& operator=(const perf_counter_group&) = delete;
+
+	~perf_counter_group()
+	{
+#ifdef __linux__
+		for (auto fd : fds)
+			{
+				if (fd >= 0) close(fd);
+			}
+#endif
+	}
+
+	/// @brief If any counter could be opened
+	bool available() const { return opened != 0; }
+
+	bool supported(hardware_counter counter) const
+	{
+		for (size_t i = 0; i < opened; ++i)
+			{
+				if (order[i] == counter) return true;
+			}
+		return false;
+	}
+
+	/**
+	 * @brief The counts since the group was opened. If the kernel had to share the hardware
+	 * counters with other groups, they are scaled up to the whole time.
+	 */
+	hardware_counters read() const
+	{
+		hardware_counters ret;
+#ifdef __linux__
+		if (!opened) return ret;
+
+		// the number of counters, the time enabled and running, then the values
+		std::array<std::uint64_t, 3 + size_t(hardware_counter::count)> buffer{};
+		if (::read(leader, buffer.data(), sizeof(buffer)) < 0) return ret;
+
+		auto enabled = buffer[1], running = buffer[2];
+		for (size_t i = 0; i < opened && i < buffer[0]; ++i)
+			{
+				auto value = buffer[3 + i];
+				if (running && running < enabled)
+					{
+						value = std::uint64_t(double(value) * double(enabled) / double(running));
+					}
+				ret[order[i]] = value;
+			}
+#endif
+		return ret;
+	}
+
+private:
+#ifdef __linux__
+	static void set_event(hardware_counter counter, perf_event_attr& attr)
+	{
+		constexpr std::uint64_t readMiss =
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+		attr.type = PERF_TYPE_HARDWARE;
+		switch (counter)
+			{
+			case hardware_counter::cycles:
+				attr.config = PERF_COUNT_HW_CPU_CYCLES;
+				break;
+			case hardware_counter::instructions:
+				attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+				break;
+			case hardware_counter::l1d_read_misses:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = PERF_COUNT_HW_CACHE_L1D | readMiss;
+				break;
+			case hardware_counter::llc_read_misses:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = PERF_COUNT_HW_CACHE_LL | readMiss;
+				break;
+			case hardware_counter::branch_misses:
+				attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+				break;
+			default:
+				attr.type = PERF_TYPE_SOFTWARE;
+				attr.config = PERF_COUNT_SW_TASK_CLOCK;
+				break;
+			}
+	}
+
+	std::array<int, size_t(hardware_counter::count)> fds;
+	int leader = -1;
+#endif
+	// the counters opened, in the order they are in the group
+	std::array<hardware_counter, size_t(hardware_counter::count)> order{};
+	size_t opened = 0;
+};
+}
@@ -0,0 +1,326 @@
+/// @brief This defines the instrumentation used by the manager
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "ecs/perf_counters.hpp"
+
+namespace ecs
+{
+/// @brief The statistics gathered for one call site (for example one run_all_matching signature)
+struct call_site_stats
+{
+	std::string name;
+	/// How many times the call site was entered
+	size_t calls = 0;
+	/// How many entities were visited (or created/destroyed) in total
+	size_t entities = 0;
+	std::chrono::nanoseconds total_time{0};
+	std::chrono::nanoseconds max_time{0};
+	/// How many of the calls were counted by the hardware counters, and what they counted in total
+	/// (see profiler::set_hardware_counters_enabled())
+	size_t counted_calls = 0;
+	hardware_counters counters{};
+};
+
+namespace detail
+{
+// writes the statistics of every site as CSV, see profiler::write_counters()
+inline void write_site_counters(std::ostream& stream, const std::vector<call_site_stats>& sites)
+{
+	stream << "site,calls,entities,total_ns,counted_calls";
+	for (size_t i = 0; i < size_t(hardware_counter::count); ++i)
+		{
+			stream << ',' << hardware_counter_name(hardware_counter(i));
+		}
+	stream << '\n';
+
+	for (const auto& site : sites)
+		{
+			// names have commas between the components
+			stream << '"' << site.name << "\"," << site.calls << ',' << site.entities << ','
+				   << site.total_time.count() << ',' << site.counted_calls;
+			for (auto value : site.counters.values)
+				{
+					stream << ',' << value;
+				}
+			stream << '\n';
+		}
+}
+
+inline std::atomic<size_t> next_site_key{0};
+
+// a number for the call site type `F`, the same in every profiler, so a profiler finds the ID of
+// the site by indexing a vector instead of hashing its name
+template <typename F>
+size_t site_key()
+{
+	static const size_t key = next_site_key.fetch_add(1, std::memory_order_relaxed);
+	return key;
+}
+}
+
+#ifdef MOD_ECS_PROFILE
+
+/// @brief Collects per call site statistics and an optional trace of every call
+/// Enabled by defining MOD_ECS_PROFILE; otherwise every member is a no-op and the timers compile
+/// away to nothing.
+class profiler
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	static constexpr bool enabled = true;
+
+	/**
+	 * @brief Gets the ID of the call site named \c name, registering it if needed.
+	 */
+	size_t site_id(const std::string& name)
+	{
+		auto iter = sitesByName.find(name);
+		if (iter != sitesByName.end()) return iter->second;
+
+		auto id = add_site(name);
+		sitesByName.emplace(name, id);
+		return id;
+	}
+
+	/**
+	 * @brief Gets the ID of the call site identified by the type of \c make_name, usually a
+	 * lambda written at the call site. \c make_name is only called the first time the site is
+	 * seen, so it can afford to build the name; after that this is a vector lookup, cheap enough
+	 * for timing short calls like new_entity(). Sites with the same name are merged.
+	 */
+	template <typename F, typename = std::enable_if_t<!std::is_convertible<F, std::string>::value>>
+	size_t site_id(F&& make_name)
+	{
+		auto key = detail::site_key<std::decay_t<F>>();
+		if (key < sitesByKey.size() && sitesByKey[key] != no_site) return sitesByKey[key];
+
+		auto id = site_id(std::string(std::forward<F>(make_name)()));
+		if (key >= sitesByKey.size()) sitesByKey.resize(key + 1, no_site);
+		sitesByKey[key] = id;
+		return id;
+	}
+
+	void record(size_t site, clock::time_point start, clock::time_point end, size_t entities,
+				const hardware_counters* counted = nullptr)
+	{
+		auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+
+		auto& stats = sites[site];
+		++stats.calls;
+		stats.entities += entities;
+		stats.total_time += duration;
+		if (duration > stats.max_time) stats.max_time = duration;
+		if (counted)
+			{
+				++stats.counted_calls;
+				stats.counters += *counted;
+			}
+
+		if (traceEnabled)
+			{
+				trace.push_back({site, start, duration, entities, std::this_thread::get_id()});
+			}
+	}
+
+	/// @brief The statistics of every call site seen so far, in the order they were first seen
+	const std::vector<call_site_stats>& stats() const { return sites; }
+
+	/// @brief Turns recording of individual calls for write_chrome_trace on or off (default off).
+	/// Every call adds an event until reset(), so leave it off outside of the frames to look at.
+	void set_trace_enabled(bool enable) { traceEnabled = enable; }
+
+	/**
+	 * @brief Turns reading the hardware performance counters around every call on or off
+	 * (default off). They are the counters of the thread calling this, calls on other threads
+	 * aren't counted. Reading them takes a system call at both ends of every call, so this is
+	 * best left off while timing short calls like new_entity().
+	 *
+	 * @return If counters are available (see perf_counter_group)
+	 */
+	bool set_hardware_counters_enabled(bool enable)
+	{
+		counterGroup.reset();
+		if (enable)
+			{
+				counterGroup = std::make_unique<perf_counter_group>();
+				counterThread = std::this_thread::get_id();
+				if (!counterGroup->available()) counterGroup.reset();
+			}
+		return counterGroup != nullptr;
+	}
+
+	/// @brief If the calls on this thread are counted, see set_hardware_counters_enabled()
+	bool counting() const
+	{
+		return counterGroup && std::this_thread::get_id() == counterThread;
+	}
+
+	hardware_counters read_counters() const { return counterGroup->read(); }
+
+	/**
+	 * @brief Writes the statistics of every call site, with the hardware counters, as CSV: one
+	 * line per site, with the totals of all its calls
+	 */
+	void write_counters(std::ostream& stream) const { detail::write_site_counters(stream, sites); }
+
+	/// @brief Writes every recorded call in the Chrome trace-event JSON format (chrome://tracing)
+	void write_chrome_trace(std::ostream& stream) const
+	{
+		std::unordered_map<std::thread::id, size_t> threadIDs;
+
+		stream << "{\"traceEvents\":[";
+		for (size_t i = 0; i < trace.size(); ++i)
+			{
+				const auto& event = trace[i];
+				auto tid = threadIDs.emplace(event.thread, threadIDs.size()).first->second;
+
+				auto startUs = std::chrono::duration<double, std::micro>(event.start - epoch);
+				auto durationUs = std::chrono::duration<double, std::micro>(event.duration);
+
+				if (i != 0) stream << ',';
+				stream << "{\"name\":\"" << escape(sites[event.site].name)
+					   << "\",\"cat\":\"ecs\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+					   << ",\"ts\":" << startUs.count() << ",\"dur\":" << durationUs.count()
+					   << ",\"args\":{\"entities\":" << event.entities << "}}";
+			}
+		stream << "],\"displayTimeUnit\":\"ns\"}";
+	}
+
+	/// @brief Forgets all statistics and recorded calls, but keeps the call sites
+	void reset()
+	{
+		for (auto& site : sites)
+			{
+				site = call_site_stats{site.name};
+			}
+		trace.clear();
+		epoch = clock::now();
+	}
+
+private:
+	struct trace_event
+	{
+		size_t site;
+		clock::time_point start;
+		std::chrono::nanoseconds duration;
+		size_t entities;
+		std::thread::id thread;
+	};
+
+	size_t add_site(std::string name)
+	{
+		sites.push_back(call_site_stats{std::move(name)});
+		return sites.size() - 1;
+	}
+
+	static std::string escape(const std::string& str)
+	{
+		std::string ret;
+		for (auto c : str)
+			{
+				if (c == '"' || c == '\\') ret += '\\';
+				ret += c;
+			}
+		return ret;
+	}
+
+	std::vector<call_site_stats> sites;
+	std::unordered_map<std::string, size_t> sitesByName;
+	// the site ID for every detail::site_key(), or no_site
+	static constexpr size_t no_site = ~size_t(0);
+	std::vector<size_t> sitesByKey;
+
+	std::vector<trace_event> trace;
+	bool traceEnabled = false;
+	clock::time_point epoch = clock::now();
+
+	std::unique_ptr<perf_counter_group> counterGroup;
+	std::thread::id counterThread;
+};
+
+/// @brief Times the scope it lives in and records it to a profiler
+class scoped_timer
+{
+public:
+	template <typename Name>
+	scoped_timer(profiler& prof_, Name&& name)
+		: prof{prof_}, site{prof_.site_id(std::forward<Name>(name))}, counting{prof_.counting()}
+	{
+		if (counting) startCounts = prof.read_counters();
+		start = profiler::clock::now();
+	}
+	scoped_timer(const scoped_timer&) = delete;
+
+	/// @brief Adds \c count entities to the amount visited in this scope
+	void add_entities(size_t count) { entities += count; }
+
+	~scoped_timer()
+	{
+		auto end = profiler::clock::now();
+		if (counting && prof.counting())
+			{
+				auto counted = prof.read_counters() - startCounts;
+				prof.record(site, start, end, entities, &counted);
+				return;
+			}
+		prof.record(site, start, end, entities);
+	}
+private:
+	profiler& prof;
+	size_t site;
+	bool counting;
+	hardware_counters startCounts;
+	profiler::clock::time_point start;
+	size_t entities = 0;
+};
+
+#else
+
+class profiler
+{
+public:
+	static constexpr bool enabled = false;
+
+	const std::vector<call_site_stats>& stats() const
+	{
+		static const std::vector<call_site_stats> empty;
+		return empty;
+	}
+	void set_trace_enabled(bool) {}
+	bool set_hardware_counters_enabled(bool) { return false; }
+	void write_chrome_trace(std::ostream& stream) const
+	{
+		stream << "{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}";
+	}
+	void write_counters(std::ostream& stream) const { detail::write_site_counters(stream, {}); }
+	void reset() {}
+};
+
+class scoped_timer
+{
+public:
+	template <typename Name>
+	scoped_timer(profiler&, Name&&)
+	{
+	}
+	scoped_timer(const scoped_timer&) = delete;
+
+	void add_entities(size_t) {}
+};
+
+#endif
+}
@@ -0,0 +1,112 @@
+/// @brief This defines query_view, the entities matching a signature as a random access range
+
+#pragma once
+
+#include <boost/hana.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+
+#include <cstddef>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace ecs
+{
+namespace detail
+{
+template <typename Storages>
+struct query_reference;
+
+template <typename... Storages>
+struct query_reference<boost::hana::tuple<Storages*...>>
+{
+	using type = std::tuple<typename Storages::mapped_type&...>;
+};
+}
+
+/**
+ * @brief The entities matching a signature, as a random access range of std::tuple<>s of
+ * references to their storage components (in the order of the signature). Being random access,
+ * it splits into chunks of any size, so it works with the parallel overloads of the standard
+ * algorithms:
+ *
+ * ```
+ * auto ships = man.query(make_type_tuple<ship, mass>);
+ * auto total = std::transform_reduce(std::execution::par_unseq, ships.begin(), ships.end(), 0.f,
+ *                                    std::plus<>{}, [](auto components) {
+ *                                        return std::get<0>(components).value;
+ *                                    });
+ * ```
+ *
+ * The entities are the ones matching when the view was made by manager::query(); the view and its
+ * iterators must not be used after entities are created or destroyed, or after the manager is
+ * gone. The iterators are proxy iterators, like those of a zip: dereferencing gives a tuple of
+ * references by value, so take it by value or with `auto&&`.
+ *
+ * \c Index is the type the manager stores entity IDs as (see manager::index_type).
+ */
+template <typename Storages, typename Index = std::size_t>
+class query_view
+{
+public:
+	using reference = typename detail::query_reference<Storages>::type;
+
+	class iterator
+		: public boost::iterator_facade<iterator, reference, std::random_access_iterator_tag,
+										reference>
+	{
+	public:
+		iterator() = default;
+		iterator(Storages storages_, const Index* ids_) : storages{storages_}, ids{ids_} {}
+
+		/// @brief The ID of the entity this points to
+		size_t id() const { return *ids; }
+
+		// iterator_facade would return a proxy here, as the references aren't real references
+		reference operator[](std::ptrdiff_t n) const { return get_components(storages, ids[n]); }
+
+	private:
+		friend class boost::iterator_core_access;
+
+		reference dereference() const { return get_components(storages, *ids); }
+		bool equal(const iterator& other) const { return ids == other.ids; }
+		void increment() { ++ids; }
+		void decrement() { --ids; }
+		void advance(std::ptrdiff_t n) { ids += n; }
+		std::ptrdiff_t distance_to(const iterator& other) const { return other.ids - ids; }
+
+		// the iterators don't point to the view, so they stay valid when it is moved
+		Storages storages;
+		const Index* ids = nullptr;
+	};
+	using const_iterator = iterator;
+
+	query_view(Storages storages_, std::vector<Index> matching_)
+		: storages{storages_}, matching{std::move(matching_)}
+	{
+	}
+
+	iterator begin() const { return {storages, matching.data()}; }
+	iterator end() const { return {storages, matching.data() + matching.size()}; }
+
+	size_t size() const { return matching.size(); }
+	bool empty() const { return matching.empty(); }
+
+	/// @brief The components of the \c i th matching entity
+	reference operator[](size_t i) const { return get_components(storages, matching[i]); }
+
+	/// @brief The IDs of the matching entities, in the order of the view
+	const std::vector<Index>& ids() const { return matching; }
+
+private:
+	static reference get_components(const Storages& storages, size_t id)
+	{
+		return boost::hana::unpack(storages,
+								   [id](auto... storage) { return reference{(*storage)[id]...}; });
+	}
+
+	Storages storages;
+	std::vector<Index> matching;
+};
+}
@@ -5,8 +5,18 @@
 #include <boost/compressed_pair.hpp>
 #include <boost/optional.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <exception>
 #include <memory>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 #include <initializer_list>
 
@@ -38,29 +48,336 @@
 //         0 * segment_size + j | j|....   |             i * segment_size + k | j|....   |
 //                              |__________|                                  |__________|
 //
+namespace detail
+{
+// stands in for the map in the copy operations of a segmented_map of move-only values, so it
+// has none: they would share segments that can't be copied when written to
+struct uncopyable_map
+{
+};
+
+// the index of the highest set bit of `n`, which must not be 0
+inline size_t floor_log2(size_t n)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(n);
+#else
+	size_t ret = 0;
+	while (n >>= 1) ++ret;
+	return ret;
+#endif
+}
+
+// the number of set bits of `n`
+inline size_t popcount(std::uint64_t n)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(n);
+#else
+	size_t ret = 0;
+	for (; n; n &= n - 1) ++ret;
+	return ret;
+#endif
+}
+
+// The directory of segment pointers of a segmented_map. Unlike a std::vector its entries never
+// move when it grows, so other threads may read entries [0, size()) while one thread grows it or
+// sets entries. The entries are kept in blocks, block b holding first_block_size << b of them, and
+// the table of blocks has a fixed size, so growing never copies anything.
+template <typename T>
+class segment_directory
+{
+public:
+	static constexpr size_t first_block_size = 64;
+	static constexpr size_t max_blocks = 48;
+
+	segment_directory() = default;
+	segment_directory(const segment_directory&) = delete;
+	segment_directory(segment_directory&& other) noexcept { swap(other); }
+	segment_directory& operator=(const segment_directory&) = delete;
+	segment_directory& operator=(segment_directory&& other) noexcept
+	{
+		if (this != &other)
+			{
+				clear();
+				swap(other);
+			}
+		return *this;
+	}
+	~segment_directory() { clear(); }
+
+	size_t size() const { return count.load(std::memory_order_acquire); }
+	size_t max_size() const { return block_start(max_blocks); }
+	// the amount of entries the allocated blocks have room for
+	size_t capacity() const
+	{
+		size_t blocksUsed = 0;
+		while (blocksUsed < max_blocks && blocks[blocksUsed].load(std::memory_order_relaxed))
+			{
+				++blocksUsed;
+			}
+		return block_start(blocksUsed);
+	}
+
+	T* operator[](size_t i) const { return entry(i).load(std::memory_order_acquire); }
+	void set(size_t i, T* ptr) { entry(i).store(ptr, std::memory_order_release); }
+
+	// grows the directory to `newSize` null entries (it never shrinks)
+	void resize(size_t newSize)
+	{
+		auto oldSize = size();
+		if (newSize <= oldSize) return;
+
+		for (auto b = oldSize == 0 ? 0 : block_of(oldSize - 1); b <= block_of(newSize - 1); ++b)
+			{
+				if (blocks[b].load(std::memory_order_relaxed)) continue;
+
+				auto block = new std::atomic<T*>[first_block_size << b];
+				for (size_t i = 0; i < (first_block_size << b); ++i)
+					{
+						block[i].store(nullptr, std::memory_order_relaxed);
+					}
+				blocks[b].store(block, std::memory_order_release);
+			}
+		count.store(newSize, std::memory_order_release);
+	}
+
+	// frees the blocks (but not the segments the entries point to)
+	void clear()
+	{
+		for (auto& block : blocks)
+			{
+				delete[] block.exchange(nullptr, std::memory_order_relaxed);
+			}
+		count.store(0, std::memory_order_release);
+	}
+
+	void swap(segment_directory& other) noexcept
+	{
+		for (size_t b = 0; b < max_blocks; ++b)
+			{
+				auto otherBlock = other.blocks[b].load(std::memory_order_relaxed);
+				other.blocks[b].store(blocks[b].exchange(otherBlock, std::memory_order_relaxed),
+									  std::memory_order_relaxed);
+			}
+		other.count.store(count.exchange(other.count.load(std::memory_order_relaxed),
+										 std::memory_order_acq_rel),
+						  std::memory_order_release);
+	}
+
+private:
+	static size_t block_of(size_t i) { return floor_log2(i / first_block_size + 1); }
+	static size_t block_start(size_t b) { return first_block_size * ((size_t(1) << b) - 1); }
+
+	std::atomic<T*>& entry(size_t i) const
+	{
+		auto b = block_of(i);
+		return blocks[b].load(std::memory_order_acquire)[i - block_start(b)];
+	}
+
+	std::array<std::atomic<std::atomic<T*>*>, max_blocks> blocks{};
+	std::atomic<size_t> count{0};
+};
+}
+
+// Memory statistics of a segmented_map, see segmented_map::memory_stats()
+struct segmented_map_stats
+{
+	// elements per segment
+	size_t segment_size = 0;
+	// entries in the segment directory, allocated or not
+	size_t directory_size = 0;
+	// bytes used by the directory itself
+	size_t directory_bytes = 0;
+	size_t segments_allocated = 0;
+	// allocated segments still shared with a copy of the map; they are counted in both
+	size_t segments_shared = 0;
+	// bytes used by the allocated segments
+	size_t segment_bytes = 0;
+	size_t live_elements = 0;
+	// bytes of allocated slots that hold no element
+	size_t empty_slot_bytes = 0;
+	// bytes spent on top of the elements to track which slots hold one (the bitmaps of the
+	// segments)
+	size_t padding_bytes = 0;
+	// live elements in each directory entry (0 for entries without a segment)
+	std::vector<size_t> occupancy;
+	// occupancy_histogram[n] is the number of allocated segments holding exactly n elements
+	std::vector<size_t> occupancy_histogram;
+
+	size_t total_bytes() const { return directory_bytes + segment_bytes; }
+};
+
+// How many elements the segments of a segmented_map of `Value` hold by default. Specialize it to
+// tune a type (bench/segment_size_sweep.cpp measures the candidates), or pass the size to
+// segmented_map directly.
+template <typename Value>
+struct segment_traits
+{
+	// about how many bytes a segment should take
+	static constexpr size_t target_bytes = 4096;
+	// segments never hold fewer elements than this, however large the elements are
+	static constexpr size_t min_elements = 4;
+
+	static constexpr size_t elements =
+		std::max(min_elements, target_bytes / sizeof(Value));
+};
+
+// the alignment of the segments, so no segment shares a cache line with another allocation
+constexpr size_t segment_alignment = 64;
+
+// Only the values are stored in the segments (the key is implied by the position), so iterators
+// dereference to a `std::pair<const Key, Value&>` proxy instead of a real `value_type&`.
 template <typename Key, typename Value, typename Compare = std::less<Key>,
-		  typename Alloc = std::allocator<std::pair<Key, Value>>>
+		  typename Alloc = std::allocator<std::pair<Key, Value>>,
+		  size_t SegmentSize = segment_traits<Value>::elements>
 class segmented_map
 {
 public:
 	static_assert(std::is_integral<Key>::value, "Must be integral");
+	static_assert(SegmentSize > 0, "Segments must hold at least one element");
 
 	// the size of the segments
-	static constexpr size_t segment_size = 64 * 4 / sizeof(Value);
+	static constexpr size_t segment_size = SegmentSize;
+
+private:
+	// the map when it can be copied, so only then it has copy operations (the move operations
+	// being declared, the implicit ones are deleted)
+	using copy_source = std::conditional_t<std::is_copy_constructible<Value>::value, segmented_map,
+										   detail::uncopyable_map>;
+
+	// Copies of a map share their segments until one of them writes to a segment, which then
+	// gets its own copy of it (see writable_segment()). Which slots hold an element is kept in a
+	// bitmap apart from the values, so the values of a trivially copyable type are plain memory
+	// that can be filled and copied in bulk
+	struct alignas(segment_alignment) internal_array_type
+	{
+		internal_array_type() = default;
+		// copies the elements; the copy isn't shared yet
+		internal_array_type(const internal_array_type& other)
+		{
+			if constexpr (std::is_trivially_copyable<Value>::value)
+				{
+					std::memcpy(static_cast<void*>(storage), other.storage, sizeof(storage));
+					occupied = other.occupied;
+				}
+			else
+				{
+					try
+						{
+							for (size_t i = 0; i < segment_size; ++i)
+								{
+									if (other.has(i)) emplace(i, other[i]);
+								}
+						}
+					catch (...)
+						{
+							clear();
+							throw;
+						}
+				}
+		}
+		internal_array_type& operator=(const internal_array_type&) = delete;
+		~internal_array_type() { clear(); }
+
+		bool has(size_t i) const { return occupied[i / 64] >> (i % 64) & 1; }
+
+		// the element in the slot `i`, which must hold one
+		Value& operator[](size_t i) { return *std::launder(values() + i); }
+		const Value& operator[](size_t i) const { return *std::launder(values() + i); }
+
+		// constructs an element in the empty slot `i`
+		template <typename... Args>
+		Value& emplace(size_t i, Args&&... args)
+		{
+			auto value = new (static_cast<void*>(values() + i)) Value(std::forward<Args>(args)...);
+			occupied[i / 64] |= std::uint64_t(1) << (i % 64);
+			return *value;
+		}
+
+		// assigns to the element in the slot `i`, or constructs one if the slot is empty
+		template <typename M>
+		void assign(size_t i, M&& value)
+		{
+			if (has(i))
+				{
+					(*this)[i] = std::forward<M>(value);
+				}
+			else
+				{
+					emplace(i, std::forward<M>(value));
+				}
+		}
+
+		void erase(size_t i)
+		{
+			if (!has(i)) return;
+
+			(*this)[i].~Value();
+			occupied[i / 64] &= ~(std::uint64_t(1) << (i % 64));
+		}
+
+		// marks the slots [first, first + count) as holding elements, which the caller has put
+		// there by copying memory (so only for trivially copyable values)
+		void mark(size_t first, size_t count)
+		{
+			for (size_t i = first; i < first + count;)
+				{
+					size_t bits = std::min(64 - i % 64, first + count - i);
+					occupied[i / 64] |= (bits == 64 ? ~std::uint64_t(0)
+													: ((std::uint64_t(1) << bits) - 1) << (i % 64));
+					i += bits;
+				}
+		}
+
+		// how many slots hold an element
+		size_t live() const
+		{
+			size_t ret = 0;
+			for (auto word : occupied)
+				{
+					ret += detail::popcount(word);
+				}
+			return ret;
+		}
+
+		Value* values() { return reinterpret_cast<Value*>(storage); }
+		const Value* values() const { return reinterpret_cast<const Value*>(storage); }
+
+		void clear()
+		{
+			if constexpr (!std::is_trivially_destructible<Value>::value)
+				{
+					for (size_t i = 0; i < segment_size; ++i)
+						{
+							if (has(i)) (*this)[i].~Value();
+						}
+				}
+			occupied = {};
+		}
+
+		// how many maps hold this segment
+		std::atomic<size_t> refs{1};
+		// bit i % 64 of occupied[i / 64] is set if the slot i holds an element
+		std::array<std::uint64_t, (segment_size + 63) / 64> occupied{};
+		alignas(segment_alignment) alignas(Value) unsigned char storage[segment_size * sizeof(Value)];
+	};
 
+public:
 	///////////
 	// TYPEDEFS
 	///////////
 
 	// Container (http://en.cppreference.com/w/cpp/concept/Container) typedefs
 	using value_type = std::pair<Key, Value>;
-	using reference = value_type&;
-	using const_reference = const value_type&;
+	using reference = std::pair<const Key, Value&>;
+	using const_reference = std::pair<const Key, const Value&>;
 	using difference_type = ptrdiff_t;
 	using size_type = size_t;
 
 	// AssociativeContainer (http://en.cppreference.com/w/cpp/concept/AssociativeContainer) typedefs
 	using key_type = Key;
+	using mapped_type = Value;
 	using key_compare = Compare;
 	using value_compare = Compare;
 
@@ -77,23 +394,24 @@ public:
 				 const key_compare& comp_ = key_compare{})
 		: comp{comp_}
 	{
-		for (; begin != end; ++begin)
-			{
-				operator[](begin->first) = begin->second;
-			}
+		insert(begin, end);
 	}
 
-	// copy constructor
-	segmented_map(const segmented_map& other) = default;
+	// copy constructor. The segments are shared until either map writes to them, so this costs
+	// about as much as copying the directory
+	segmented_map(const copy_source& other) : comp{other.comp} { copy_segments_from(other); }
 
 	// move constructor
-	segmented_map(segmented_map&& other) = default;
+	segmented_map(segmented_map&& other) noexcept : comp{other.comp}
+	{
+		alloc_and_storage.second().swap(other.alloc_and_storage.second());
+	}
 
 	// initializer_list constuctor
 	segmented_map(std::initializer_list<value_type> il) : segmented_map{il.begin(), il.end()} {}
 	/////////////
 	// DESTRUCTOR
-	~segmented_map() = default;
+	~segmented_map() { clear(); }
 	/////////////
 
 	////////////
@@ -101,23 +419,34 @@ public:
 	////////////
 
 	// copy assignment operator
-	segmented_map& operator=(const segmented_map& other)
+	segmented_map& operator=(const copy_source& other)
 	{
-		// alloc_and_storage.second() = other.alloc_and_storage.second();
+		if (this != &other)
+			{
+				clear();
+				comp = other.comp;
+				copy_segments_from(other);
+			}
 		return *this;
 	}
 
 	// move assignment operator
-	segmented_map& operator=(segmented_map&& other)
+	segmented_map& operator=(segmented_map&& other) noexcept
 	{
-		// alloc_and_storage.second() = std::move(other.alloc_and_storage.second());
+		if (this != &other)
+			{
+				clear();
+				alloc_and_storage.second().swap(other.alloc_and_storage.second());
+				comp = other.comp;
+			}
 		return *this;
 	}
 
 	// initializer_list assignment operator
 	segmented_map& operator=(std::initializer_list<value_type> il)
 	{
-		//*this = segmented_map{il};
+		clear();
+		insert(il);
 		return *this;
 	}
 
@@ -130,268 +459,228 @@ public:
 	////////////
 
 	struct const_iterator : boost::iterator_facade<const_iterator, const value_type,
-												   boost::bidirectional_traversal_tag>
+												   boost::bidirectional_traversal_tag,
+												   const_reference>
 	{
-		size_t index;
-		const segmented_map* owning_container;
-
-		bool is_valid()
+		const_iterator() = default;
+		const_iterator(size_t index_, const segmented_map* owning_container_)
+			: index{index_}, owning_container{owning_container_}
 		{
-			return owning_container->alloc_and_storage.second()[index / segment_size] &&
-				   (*owning_container->alloc_and_storage
-						 .second()[index / segment_size])[index % segment_size];
 		}
 
-		const_reference dereference()
+		size_t index = 0;
+		const segmented_map* owning_container = nullptr;
+
+		bool is_valid() const { return owning_container->is_occupied(index); }
+	private:
+		friend class boost::iterator_core_access;
+
+		const_reference dereference() const
 		{
-			return **(owning_container->alloc_and_storage
-						  .second()[index / segment_size])[index % segment_size];
+			return {Key(index), (*owning_container->alloc_and_storage
+									  .second()[index / segment_size])[index % segment_size]};
 		}
 
-		bool equal(const_iterator other)
+		bool equal(const const_iterator& other) const
 		{
 			return index == other.index && owning_container == other.owning_container;
 		}
 
-		void increment()
+		void increment() { index = owning_container->next_occupied(index + 1); }
+		void decrement() { index = owning_container->prev_occupied(index); }
+	};
+	friend const_iterator;
+
+	struct iterator : boost::iterator_facade<iterator, value_type,
+											 boost::bidirectional_traversal_tag, reference>
+	{
+		iterator() = default;
+		iterator(size_t index_, segmented_map* owning_container_)
+			: index{index_}, owning_container{owning_container_}
 		{
-			do
-				{
-					++index;
-				}
-			while (!*(owning_container->alloc_and_storage
-						  .second()[index / segment_size])[index % segment_size]);
 		}
 
-		void decrement()
+		size_t index = 0;
+		segmented_map* owning_container = nullptr;
+
+		bool is_valid() const { return owning_container->is_occupied(index); }
+		operator const_iterator() const { return {index, owning_container}; }
+	private:
+		friend class boost::iterator_core_access;
+
+		reference dereference() const
 		{
-			std::array<boost::optional<Value>, segment_size>* arrPtr = nullptr;
-			do
-				{
-					do
-						{
-						}
-					while (
-						(arrPtr =
-							 (owning_container->alloc_and_storage.second()[index / segment_size])));
-				}
-			while (!(*arrPtr)[index % segment_size]);
+			return {Key(index), (*owning_container->writable_segment(index / segment_size))
+									[index % segment_size]};
 		}
 
-		void advance(difference_type dist)
+		bool equal(const iterator& other) const
 		{
-			for (; dist != 0; --dist)
-				{
-					decrement();
-				}
+			return index == other.index && owning_container == other.owning_container;
 		}
 
-		difference_type distance_to(const_iterator i)
-		{
-			iterator cpy = *this;
+		void increment() { index = owning_container->next_occupied(index + 1); }
+		void decrement() { index = owning_container->prev_occupied(index); }
+	};
+	friend iterator;
 
-			difference_type ret;
-			while (cpy != i)
-				{
-					++ret;
-					cpy.advance();
-				}
+	//////////////////
+	// ITERATOR ACCESS
+	//////////////////
 
-			return ret;
-		}
-	};
-	friend const_iterator;
+	iterator begin() { return {next_occupied(0), this}; }
+	iterator end() { return {end_index(), this}; }
 
-	struct iterator
-		: boost::iterator_facade<iterator, value_type, boost::bidirectional_traversal_tag>
-	{
-		size_t index;
-		segmented_map* owning_container;
+	const_iterator begin() const { return {next_occupied(0), this}; }
+	const_iterator end() const { return {end_index(), this}; }
 
-		bool is_valid()
-		{
-			return owning_container->alloc_and_storage.second()[index / segment_size] &&
-				   (*owning_container->alloc_and_storage
-						 .second()[index / segment_size])[index % segment_size];
-		}
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
 
-		reference dereference()
-		{
-			return **(owning_container->alloc_and_storage
-						  .second()[index / segment_size])[index % segment_size];
-		}
+	// Looks up keys while caching the segment of the last key, so walking keys in increasing order
+	// costs one directory lookup per segment instead of one per key. Stays valid while elements
+	// are inserted or erased, but not across clear() or anything that frees segments. A
+	// mutable cursor gets its own copy of a shared segment as it enters it; a const cursor leaves
+	// it shared, and reloads its segment if a write through the map copied it meanwhile.
+	template <bool Const>
+	class basic_cursor
+	{
+	public:
+		using map_type = std::conditional_t<Const, const segmented_map, segmented_map>;
+		using value_ref = std::conditional_t<Const, const Value&, Value&>;
 
-		bool equal(iterator other)
-		{
-			return index == other.index && owning_container == other.owning_container;
-		}
+		explicit basic_cursor(map_type& map_) : map{&map_} {}
 
-		void increment()
+		// gets the element with the key `key`, which must exist
+		value_ref operator[](const key_type& key)
 		{
-			do
-				{
-					++index;
-				}
-			while (!*(owning_container->alloc_and_storage
-						  .second()[index / segment_size])[index % segment_size]);
-		}
+			size_t segment_id = key / segment_size;
+			if (segment_id != current_id || (Const && map->stale_since(copies))) load(segment_id);
 
-		void decrement()
-		{
-			std::array<boost::optional<Value>, segment_size>* arrPtr = nullptr;
-			do
-				{
-					do
-						{
-						}
-					while (
-						(arrPtr =
-							 (owning_container->alloc_and_storage.second()[index / segment_size])));
-				}
-			while (!(*arrPtr)[index % segment_size]);
+			return (*current)[key % segment_size];
 		}
-
-		void advance(difference_type dist)
+	private:
+		void load(size_t segment_id)
 		{
-			for (; dist != 0; --dist)
+			current_id = segment_id;
+			if constexpr (Const)
 				{
-					decrement();
+					copies = map->segment_copies.load(std::memory_order_relaxed);
+					current = map->alloc_and_storage.second()[segment_id];
 				}
-		}
-
-		difference_type distance_to(iterator i)
-		{
-			iterator cpy = *this;
-
-			difference_type ret;
-			while (cpy != i)
+			else
 				{
-					++ret;
-					cpy.advance();
+					current = map->writable_segment(segment_id);
 				}
-
-			return ret;
 		}
 
-		operator const_iterator() { return {index, owning_container}; }
+		map_type* map;
+		size_t current_id = ~size_t(0);
+		// map->segment_copies when `current` was loaded
+		size_t copies = 0;
+		std::conditional_t<Const, const internal_array_type*, internal_array_type*> current =
+			nullptr;
 	};
-	friend iterator;
 
-	//////////////////
-	// ITERATOR ACCESS
-	//////////////////
+	using cursor = basic_cursor<false>;
+	using const_cursor = basic_cursor<true>;
 
-	iterator begin()
-	{
-		auto vec_it = alloc_and_storage.second().begin();
-		while (!*vec_it) ++vec_it;
+	cursor make_cursor() { return cursor{*this}; }
+	const_cursor make_cursor() const { return const_cursor{*this}; }
 
-		auto arr_it = 0;
-		while (!(*vec_it)[arr_it]) ++arr_it;
-
-		return {std::distance(alloc_and_storage.second().begin(), vec_it) * segment_size + arr_it,
-				this};
-	}
-	iterator end()
+	// calls `func(key, value)` for every element with a key >= `first` in key order, until `func`
+	// returns false. Returns the key of the element `func` returned false for (so the walk can be
+	// resumed there), or end_key() if it got to the end
+	template <typename F>
+	size_t for_each_while(size_t first, F&& func)
 	{
-		auto vec_it = alloc_and_storage.second().end();
-		while (!*vec_it) --vec_it;
-
-		auto arr_it = segment_size - 1;
-		while (!(*vec_it)[arr_it]) --arr_it;
-
-		return {std::distance(alloc_and_storage.second().begin(), vec_it) * segment_size + arr_it,
-				this};
+		return for_each_whileIMPL(*this, first, func);
 	}
-
-	const_iterator begin() const
+	// the same without writing: segments shared with a copy of the map stay shared
+	template <typename F>
+	size_t for_each_while(size_t first, F&& func) const
 	{
-		auto vec_it = alloc_and_storage.second().begin();
-		while (!*vec_it) ++vec_it;
+		return for_each_whileIMPL(*this, first, func);
+	}
 
-		auto arr_it = 0;
-		while (!(*vec_it)[arr_it]) ++arr_it;
+	// one past the largest key the map can hold without growing its directory
+	size_t end_key() const { return end_index(); }
 
-		return {std::distance(alloc_and_storage.second().begin(), vec_it) * segment_size + arr_it,
-				this};
+	// calls `func(key, value)` for every element in key order, a segment at a time. `func` may
+	// insert or erase elements; elements inserted after the current position may or may not be
+	// visited
+	template <typename F>
+	void for_each(F&& func)
+	{
+		auto visit = [&func](Key key, Value& value) {
+			func(key, value);
+			return true;
+		};
+		for_each_whileIMPL(*this, 0, visit);
 	}
-	const_iterator end() const
+	// the same without writing: segments shared with a copy of the map stay shared
+	template <typename F>
+	void for_each(F&& func) const
 	{
-		auto vec_it = alloc_and_storage.second().end();
-		while (!*vec_it) --vec_it;
-
-		auto arr_it = segment_size - 1;
-		while (!(*vec_it)[arr_it]) --arr_it;
-
-		return {std::distance(alloc_and_storage.second().begin(), vec_it) * segment_size + arr_it,
-				this};
+		auto visit = [&func](Key key, const Value& value) {
+			func(key, value);
+			return true;
+		};
+		for_each_whileIMPL(*this, 0, visit);
 	}
-
-	const_iterator cbegin() const { return begin(); }
-	const_iterator cend() const { return end(); }
 	///////////////////////
 	// ACCESS AND INSERTION
 	///////////////////////
 
 	// [] with bounds checking (throws std::out_of_range if no such `key` exists)
-	reference at(const key_type& key)
+	mapped_type& at(const key_type& key)
 	{
-		// check that the size is good
-		if (alloc_and_storage.second().size() >= key / segment_size ||
-			alloc_and_storage.second()[key / segment_size])
+		// check that the key exists
+		if (!is_occupied(key))
 			{
 				throw std::out_of_range("Out of range in segmented_map");
 			}
-		return *(alloc_and_storage.second()[key / segment_size])[key % segment_size];
+		return (*writable_segment(key / segment_size))[key % segment_size];
 	}
-	const_reference at(const key_type& key) const
+	const mapped_type& at(const key_type& key) const
 	{
-		// check that the size is good
-		if (alloc_and_storage.second().size() >= key / segment_size ||
-			alloc_and_storage.second()[key / segment_size])
+		// check that the key exists
+		if (!is_occupied(key))
 			{
 				throw std::out_of_range("Out of range in segmented_map");
 			}
-		return *(alloc_and_storage.second()[key / segment_size])[key % segment_size];
+		return (*alloc_and_storage.second()[key / segment_size])[key % segment_size];
 	}
 
-	reference operator[](const key_type& key)
+	// [] without any checking--`key` must exist
+	mapped_type& operator[](const key_type& key)
 	{
-		return *(alloc_and_storage.second()[key / segment_size])[key % segment_size];
+		return (*writable_segment(key / segment_size))[key % segment_size];
 	}
-	const_reference operator[](const key_type& key) const
+	const mapped_type& operator[](const key_type& key) const
 	{
-		return *(alloc_and_storage.second()[key / segment_size])[key % segment_size];
+		return (*alloc_and_storage.second()[key / segment_size])[key % segment_size];
 	}
 
 	// deletes all the elements
-	void clear() { alloc_and_storage.second().clear(); }
-	// insertion
-	std::pair<iterator, bool> insert(const value_type& value)
+	void clear()
 	{
-		size_t segment_id = value.first / segment_size;
-		size_t id_in_segment = value.first % segment_size;
-
-		// see if we need to allocate more on our vector
-		if (alloc_and_storage.second().size() >= segment_id)
-			{
-				alloc_and_storage.second().resize(segment_id + 1);
-			}
-
-		auto&& arrayPtr = alloc_and_storage.second()[segment_id];
-		// see if we need to allocate a new array
-		if (!arrayPtr)
-			{
-				arrayPtr = std::make_unique<internal_array_type>();
-			}
+		auto& segments = alloc_and_storage.second();
 
-		// insert the element
-		if ((*arrayPtr)[id_in_segment])
+		for (size_t i = 0; i < segments.size(); ++i)
 			{
-				return {{value.first, this}, false};
+				release_segment(segments[i]);
 			}
-		(*arrayPtr)[id_in_segment] = value.second;
-		return {{value.first, this}, true};
+		segments.clear();
+	}
+	// insertion
+	std::pair<iterator, bool> insert(const value_type& value)
+	{
+		return try_emplace(value.first, value.second);
+	}
+	std::pair<iterator, bool> insert(value_type&& value)
+	{
+		return try_emplace(value.first, std::move(value.second));
 	}
 	template <typename P,
 			  typename = std::enable_if_t<std::is_constructible<value_type, P&&>::value>>
@@ -425,116 +714,158 @@ public:
 	template <typename M>
 	std::pair<iterator, bool> insert_or_assign(const key_type& k, M&& obj)
 	{
-		size_t segment_id = k / segment_size;
-		size_t id_in_segment = k % segment_size;
+		auto& segment = get_or_create_segment(k);
 
-		// see if we need to allocate more on our vector
-		if (alloc_and_storage.second().size() >= segment_id)
+		if (segment.has(k % segment_size))
 			{
-				alloc_and_storage.second().resize(segment_id + 1);
+				segment[k % segment_size] = std::forward<M>(obj);
+				return {{size_t(k), this}, false};
 			}
+		segment.emplace(k % segment_size, std::forward<M>(obj));
+		return {{size_t(k), this}, true};
+	}
+	template <typename M>
+	iterator insert_or_assign(const_iterator /*hint*/, const key_type& k, M&& obj)
+	{
+		return insert_or_assign(k, std::forward<M>(obj)).first;
+	}
 
-		auto&& arrayPtr = alloc_and_storage.second()[segment_id];
-		// see if we need to allocate a new array
-		if (!arrayPtr)
-			{
-				arrayPtr = new internal_array_type();
-			}
+	// constructs the value in place from `args` if there is no element with the key `k` yet;
+	// otherwise `args` are left alone
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace(const key_type& k, Args&&... args)
+	{
+		auto& segment = get_or_create_segment(k);
 
-		(*arrayPtr)[id_in_segment] = obj;
-		// insert the element
-		if ((*arrayPtr)[id_in_segment])
+		if (segment.has(k % segment_size))
 			{
-				return {{k, this}, false};
+				return {{size_t(k), this}, false};
 			}
-		return {{k, this}, true};
+		segment.emplace(k % segment_size, std::forward<Args>(args)...);
+		return {{size_t(k), this}, true};
 	}
-	template <typename M>
-	iterator insert_or_assign(const_iterator /*hint*/, const key_type& k, M&& obj)
+	template <typename... Args>
+	iterator try_emplace(const_iterator /*hint*/, const key_type& k, Args&&... args)
 	{
-		insert_or_assign(k, std::forward<M>(obj));
+		return try_emplace(k, std::forward<Args>(args)...).first;
 	}
 
-	// perfect forward the construction of the value_type
+	// perfect forward the construction of the value_type. The common (key, value) form constructs
+	// the value right in its slot; the others build a value_type first and move it in
+	template <typename K, typename M>
+	std::pair<iterator, bool> emplace(K&& k, M&& obj)
+	{
+		return try_emplace(key_type(k), std::forward<M>(obj));
+	}
 	template <typename... Args>
 	std::pair<iterator, bool> emplace(Args&&... args)
 	{
-		// TODO: optimize
-		return insert(value_type(std::forward<Args>(args)...));
+		value_type value(std::forward<Args>(args)...);
+		return try_emplace(value.first, std::move(value.second));
 	}
 
 	// perfect forward the construction of the value_type with hint
 	template <typename... Args>
 	iterator emplace_hint(const_iterator /*hint*/, Args&&... args)
 	{
-		return emplace(std::forward<Args>(args)...);
+		return emplace(std::forward<Args>(args)...).first;
 	}
 
-	// counts the amount of keys equal to `key`. Either 0 or 1
-	size_type count(const key_type& key) const
+	// sets every key in [first, last) to `value`, replacing the elements already there. Trivially
+	// copyable values are filled by copying memory, a segment at a time
+	void assign_range(const key_type& first, const key_type& last, const mapped_type& value)
 	{
-		size_t segment_id = key / segment_size;
-
-		if (alloc_and_storage().second().size() <= segment_id)
+		size_t index = first;
+		while (index < size_t(last))
 			{
-				return 0;
-			}
-
-		if (!alloc_and_storage().second()[segment_id])
-			{
-				return 0;
+				auto& segment = get_or_create_segment(index);
+				size_t offset = index % segment_size;
+				size_t count = std::min(segment_size - offset, size_t(last) - index);
+
+				if constexpr (std::is_trivially_copyable<Value>::value)
+					{
+						// copy the first value, then keep doubling the filled part
+						auto values = segment.values() + offset;
+						std::memcpy(static_cast<void*>(values), &value, sizeof(Value));
+						for (size_t done = 1; done < count;)
+							{
+								auto chunk = std::min(done, count - done);
+								std::memcpy(static_cast<void*>(values + done), values,
+											chunk * sizeof(Value));
+								done += chunk;
+							}
+						segment.mark(offset, count);
+					}
+				else
+					{
+						for (size_t i = offset; i < offset + count; ++i)
+							{
+								segment.assign(i, value);
+							}
+					}
+				index += count;
 			}
+	}
 
-		if (!(*alloc_and_storage().second()[segment_id])[key % segment_size])
+	// sets the keys [first, first + count) to the values [values, values + count), replacing the
+	// elements already there. Each segment is looked up once, and trivially copyable values are
+	// overwritten without checking what the slots held
+	template <typename InputIt>
+	void assign_values(const key_type& first, InputIt values, size_t count)
+	{
+		size_t index = first, last = size_t(first) + count;
+		while (index < last)
 			{
-				return 0;
+				auto& segment = get_or_create_segment(index);
+				size_t offset = index % segment_size;
+				size_t run = std::min(segment_size - offset, last - index);
+
+				for (size_t i = offset; i < offset + run; ++i, ++values)
+					{
+						if constexpr (std::is_trivially_copyable<Value>::value)
+							{
+								new (static_cast<void*>(segment.values() + i)) Value(*values);
+							}
+						else
+							{
+								segment.assign(i, *values);
+							}
+					}
+				if constexpr (std::is_trivially_copyable<Value>::value) segment.mark(offset, run);
+				index += run;
 			}
-
-		return 1;
 	}
 
-	// gets an iterator with the key `key`, or end()
-	iterator find(const key_type& key)
+	// checks if the segment that would hold `key` has been allocated
+	bool has_segment_for(const key_type& key) const
 	{
 		size_t segment_id = key / segment_size;
 
-		if (alloc_and_storage().second().size() <= segment_id)
-			{
-				return end();
-			}
+		return segment_id < alloc_and_storage.second().size() &&
+			   alloc_and_storage.second()[segment_id];
+	}
 
-		if (!alloc_and_storage().second()[segment_id])
-			{
-				return end();
-			}
+	// counts the amount of keys equal to `key`. Either 0 or 1
+	size_type count(const key_type& key) const { return is_occupied(key) ? 1 : 0; }
 
-		if (!(*alloc_and_storage().second()[segment_id])[key % segment_size])
+	// gets an iterator with the key `key`, or end()
+	iterator find(const key_type& key)
+	{
+		if (!is_occupied(key))
 			{
 				return end();
 			}
 
-		return {key, this};
+		return {size_t(key), this};
 	}
 	const_iterator find(const key_type& key) const
 	{
-		size_t segment_id = key / segment_size;
-
-		if (alloc_and_storage().second().size() <= segment_id)
-			{
-				return end();
-			}
-
-		if (!alloc_and_storage().second()[segment_id])
+		if (!is_occupied(key))
 			{
 				return end();
 			}
 
-		if (!(*alloc_and_storage().second()[segment_id])[key % segment_size])
-			{
-				return end();
-			}
-
-		return {key, this};
+		return {size_t(key), this};
 	}
 
 	// returns a range of the elements in the container matching `key`
@@ -542,7 +873,7 @@ public:
 	{
 		auto iter = find(key);
 
-		if (iter != end()) return {iter, iter++};
+		if (iter != end()) return {iter, std::next(iter)};
 
 		return {iter, iter};
 	}
@@ -550,7 +881,7 @@ public:
 	{
 		auto iter = find(key);
 
-		if (iter != cend()) return {iter, iter++};
+		if (iter != cend()) return {iter, std::next(iter)};
 
 		return {iter, iter};
 	}
@@ -566,83 +897,481 @@ public:
 	}
 
 	// return an iterator pointing to the first elemnt not less than `key`
-	iterator lower_bound(const key_type& key)
-	{
-		iterator iter = {key, this};
+	iterator lower_bound(const key_type& key) { return {next_occupied(key), this}; }
+	const_iterator lower_bound(const key_type& key) const { return {next_occupied(key), this}; }
 
-		if (iter.is_valid())
-			return iter;
-		else
-			return ++iter;
-	}
-	const_iterator lower_bound(const key_type& key) const
+	// retuns an iterator pointing to the first element greater than `key`
+	iterator upper_bound(const key_type& key) { return {next_occupied(key + 1), this}; }
+	const_iterator upper_bound(const key_type& key) const
 	{
-		const_iterator iter = {key, this};
-
-		if (iter.is_valid())
-			return iter;
-		else
-			return ++iter;
+		return {next_occupied(key + 1), this};
 	}
 
-	// retuns an iterator pointing to the first element greater than `key`
-	iterator upper_bound(const key_type& key)
+	// erases elements
+	iterator erase(const_iterator pos)
 	{
-		auto ret = iterator{key, this};
-		ret.increment();
-
-		return ret;
+		erase(Key(pos.index));
+		return {next_occupied(pos.index + 1), this};
 	}
-	const_iterator upper_bound(const key_type& key) const
+	iterator erase(const_iterator first, const_iterator last)
 	{
-		auto ret = const_iterator{key, this};
-		ret.increment();
-
-		return ret;
+		while (first != last)
+			{
+				first = erase(first);
+			}
+		return {last.index, this};
 	}
+	size_type erase(const key_type& key)
+	{
+		if (!is_occupied(key))
+			{
+				return 0;
+			}
 
-	// erases elements
-	iterator erase(const_iterator pos);
-	iterator erase(const_iterator first, const_iterator last);
-	size_type erase(const key_type& key);
+		writable_segment(key / segment_size)->erase(key % segment_size);
+		return 1;
+	}
 
 	//////////////////
 	// OTHER FUNCTIONS
 	//////////////////
 
-	void swap(const segmented_map& other)
+	void swap(segmented_map& other)
+	{
+		alloc_and_storage.second().swap(other.alloc_and_storage.second());
+		std::swap(comp, other.comp);
+	}
+
+	// moves every element of `other` into this map, leaving `other` empty. Elements whose key is
+	// already in this map replace the old value. Segments this map doesn't have yet are taken over
+	// as a whole instead of being copied.
+	void merge(segmented_map&& other)
 	{
-		return std::swap(alloc_and_storage, other.alloc_and_storage);
+		auto& segments = alloc_and_storage.second();
+		auto& otherSegments = other.alloc_and_storage.second();
+
+		if (segments.size() < otherSegments.size()) segments.resize(otherSegments.size());
+
+		for (size_t i = 0; i < otherSegments.size(); ++i)
+			{
+				if (!otherSegments[i]) continue;
+
+				if (!segments[i])
+					{
+						segments.set(i, otherSegments[i]);
+					}
+				else
+					{
+						auto otherSegment = other.writable_segment(i);
+						auto segment = writable_segment(i);
+						for (size_t j = 0; j < segment_size; ++j)
+							{
+								if (otherSegment->has(j)) segment->assign(j, std::move((*otherSegment)[j]));
+							}
+						release_segment(otherSegment);
+					}
+				otherSegments.set(i, nullptr);
+			}
+		otherSegments.clear();
 	}
 
 	// size functions
 	// WARNING: this is slow
-	size_type size() const
+	size_type size() const { return std::distance(begin(), end()); }
+	size_type max_size() const { return alloc_and_storage.second().max_size() * segment_size; }
+	bool empty() const { return begin() == end(); }
+	Alloc& get_allocator() { return alloc_and_storage.first(); }
+
+	// moves the element with the key `k` to the key `remap[k]`, dropping it if `remap[k]` is
+	// `invalid_key`. `remap` must have an entry for every key in the map, and no two elements may
+	// be moved to the same key. The old segments are freed as soon as they are drained.
+	// Like the other functions taking a list of keys, the keys in `remap` may be of a wider type
+	// than Key, like the size_t handles of a manager storing its IDs as uint32_t.
+	template <typename K>
+	void remap_keys(const std::vector<K>& remap, K invalid_key = ~K(0))
 	{
-		auto it = const_iterator{0, this};
+		auto& segments = alloc_and_storage.second();
 
-		size_t count = 0;
-		if (it.is_valid())
+		segmented_map remapped{comp};
+		for (size_t i = 0; i < segments.size(); ++i)
 			{
-				count = 1;
+				if (!segments[i]) continue;
+
+				auto segment = writable_segment(i);
+				for (size_t j = 0; j < segment_size; ++j)
+					{
+						if (!segment->has(j)) continue;
+
+						auto newKey = remap[i * segment_size + j];
+						if (newKey != invalid_key)
+							{
+								remapped.get_or_create_segment(newKey).assign(
+									newKey % segment_size, std::move((*segment)[j]));
+							}
+					}
+
+				release_segment(segment);
+				segments.set(i, nullptr);
 			}
 
-		while (it != end())
+		swap(remapped);
+	}
+
+	// copies the elements with the keys `keys[i]` to `out[i]` (`out` is a random access
+	// iterator). However the keys are ordered, they are visited by segment, so every segment is
+	// looked up once and read forward. Throws std::out_of_range if a key is missing, leaving `out`
+	// partly written.
+	template <typename K, typename OutIt>
+	void gather(const std::vector<K>& keys, OutIt out) const
+	{
+		const auto& segments = alloc_and_storage.second();
+		visit_in_key_order(
+			keys,
+			[&segments](size_t segment_id) {
+				return segment_id < segments.size() ? segments[segment_id] : nullptr;
+			},
+			[&out](size_t i, const Value& value) { out[i] = value; });
+	}
+
+	// the other way around: copies `values[i]` to the element with the key `keys[i]`, which must
+	// exist
+	template <typename K, typename InIt>
+	void scatter(const std::vector<K>& keys, InIt values)
+	{
+		visit_in_key_order(
+			keys, [this](size_t segment_id) { return writable_segment(segment_id); },
+			[&values](size_t i, Value& value) { value = values[i]; });
+	}
+
+	// for every (from, to) in `moves`, moves the element with the key `from` (or the lack of one)
+	// to `to`. The `to`s must be a permutation of the `from`s. Only the elements in `moves` are
+	// touched
+	template <typename K>
+	void permute_keys(const std::vector<std::pair<K, K>>& moves)
+	{
+		std::vector<boost::optional<Value>> values(moves.size());
+		for (size_t i = 0; i < moves.size(); ++i)
 			{
-				++count;
-				++it;
+				if (!is_occupied(moves[i].first)) continue;
+
+				auto segment = writable_segment(moves[i].first / segment_size);
+				values[i] = std::move((*segment)[moves[i].first % segment_size]);
+				segment->erase(moves[i].first % segment_size);
 			}
+		for (size_t i = 0; i < moves.size(); ++i)
+			{
+				if (!values[i]) continue;
 
-		return count;
+				get_or_create_segment(moves[i].second)
+					.assign(moves[i].second % segment_size, std::move(*values[i]));
+			}
+	}
+
+	// gives this map its own copy of every segment it still shares with a copy of it. Writing to
+	// a shared segment copies it first, so until this is done, even writes to different elements
+	// must not happen on several threads at once
+	void unshare()
+	{
+		auto& segments = alloc_and_storage.second();
+		for (size_t i = 0; i < segments.size(); ++i)
+			{
+				writable_segment(i);
+			}
+	}
+
+	// gathers memory statistics. This walks every allocated segment
+	segmented_map_stats memory_stats() const
+	{
+		const auto& segments = alloc_and_storage.second();
+
+		segmented_map_stats ret;
+		ret.segment_size = segment_size;
+		ret.directory_size = segments.size();
+		ret.directory_bytes = segments.capacity() * sizeof(internal_array_type*) +
+							  detail::segment_directory<internal_array_type>::max_blocks *
+								  sizeof(internal_array_type**);
+		ret.occupancy.resize(segments.size());
+		ret.occupancy_histogram.resize(segment_size + 1);
+
+		for (size_t i = 0; i < segments.size(); ++i)
+			{
+				if (!segments[i]) continue;
+
+				size_t live = segments[i]->live();
+
+				++ret.segments_allocated;
+				if (segments[i]->refs.load(std::memory_order_relaxed) > 1) ++ret.segments_shared;
+				ret.live_elements += live;
+				ret.occupancy[i] = live;
+				++ret.occupancy_histogram[live];
+			}
+
+		ret.segment_bytes = ret.segments_allocated * sizeof(internal_array_type);
+		ret.empty_slot_bytes =
+			(ret.segments_allocated * segment_size - ret.live_elements) * sizeof(Value);
+		ret.padding_bytes =
+			ret.segments_allocated * sizeof(std::declval<internal_array_type>().occupied);
+
+		return ret;
 	}
-	size_type max_size() const { return alloc_and_storage().second().max_size() * segment_size; }
-	bool empty() const { return alloc_and_storage().second().empty(); }
-	Alloc& get_allocator() { return alloc_and_storage.first(); }
 	key_compare key_comp() { return comp; }
 	value_compare value_comp() { return comp; }
 private:
-	using internal_array_type = std::array<boost::optional<Value>, segment_size>;
-	boost::compressed_pair<Alloc, std::vector<internal_array_type*>> alloc_and_storage;
+	// the directory may be read from other threads while this one adds segments, see
+	// detail::segment_directory
+	boost::compressed_pair<Alloc, detail::segment_directory<internal_array_type>> alloc_and_storage;
 
 	key_compare comp;
+	// how many times writable_segment() replaced a shared segment by a copy, so what reads without
+	// writing (the const cursors and for_each) can tell the segment they hold went stale
+	std::atomic<size_t> segment_copies{0};
+
+	// one past the last index that could hold an element
+	size_t end_index() const { return alloc_and_storage.second().size() * segment_size; }
+
+	bool is_occupied(size_t index) const
+	{
+		size_t segment_id = index / segment_size;
+
+		return segment_id < alloc_and_storage.second().size() &&
+			   alloc_and_storage.second()[segment_id] &&
+			   alloc_and_storage.second()[segment_id]->has(index % segment_size);
+	}
+
+	template <typename Self, typename F>
+	static size_t for_each_whileIMPL(Self& self, size_t first, F& func)
+	{
+		constexpr bool reading = std::is_const<Self>::value;
+		const auto& segments = self.alloc_and_storage.second();
+
+		for (size_t i = first / segment_size; i < segments.size(); ++i)
+			{
+				if (!segments[i]) continue;
+
+				size_t copies = self.segment_copies.load(std::memory_order_relaxed);
+				std::conditional_t<reading, const internal_array_type*, internal_array_type*>
+					segment;
+				if constexpr (reading)
+					{
+						segment = segments[i];
+					}
+				else
+					{
+						segment = self.writable_segment(i);
+					}
+
+				for (size_t j = (i == first / segment_size ? first % segment_size : 0);
+					 j < segment_size; ++j)
+					{
+						if (!segment->has(j)) continue;
+						if (!func(Key(i * segment_size + j), (*segment)[j]))
+							{
+								return i * segment_size + j;
+							}
+
+						// `func` may have written to the map, giving it its own copy of the
+						// shared segment being read
+						if (reading && self.stale_since(copies))
+							{
+								copies = self.segment_copies.load(std::memory_order_relaxed);
+								segment = segments[i];
+							}
+					}
+			}
+		return self.end_key();
+	}
+
+	// if a shared segment was replaced by a private copy since segment_copies was `copies`
+	bool stale_since(size_t copies) const
+	{
+		return segment_copies.load(std::memory_order_relaxed) != copies;
+	}
+
+	// calls `func(i, element)` for the element with the key `keys[i]`, for every i, a segment at
+	// a time in segment order. `resolve(segment id)` gives the segment (or nullptr), and is called
+	// once per segment
+	template <typename K, typename Resolve, typename F>
+	void visit_in_key_order(const std::vector<K>& keys, Resolve&& resolve, F&& func) const
+	{
+		size_t current = ~size_t(0);
+		decltype(resolve(0)) segment = nullptr;
+		auto visit = [&](size_t key, size_t i) {
+			size_t segment_id = key / segment_size;
+			if (segment_id != current)
+				{
+					segment = resolve(segment_id);
+					current = segment_id;
+				}
+			if (!segment || !segment->has(key % segment_size))
+				{
+					throw std::out_of_range("Out of range in segmented_map");
+				}
+			func(i, (*segment)[key % segment_size]);
+		};
+
+		if (std::is_sorted(keys.begin(), keys.end()))
+			{
+				for (size_t i = 0; i < keys.size(); ++i)
+					{
+						visit(keys[i], i);
+					}
+				return;
+			}
+
+		// keys past the directory come last either way, and throw when they're visited
+		size_t numSegments = alloc_and_storage.second().size();
+
+		// a few keys over a large map are sorted, which costs O(k log k) instead of a pass over
+		// the whole directory. A step of the sort costs about 8 times one of the pass (measured
+		// with bench/gather_scatter.cpp)
+		if (8 * keys.size() * detail::floor_log2(keys.size() + 1) < numSegments)
+			{
+				std::vector<std::pair<size_t, size_t>> order(keys.size());
+				for (size_t i = 0; i < keys.size(); ++i)
+					{
+						order[i] = {size_t(keys[i]), i};
+					}
+				std::sort(order.begin(), order.end());
+				for (auto& entry : order)
+					{
+						visit(keys[entry.second], entry.second);
+					}
+				return;
+			}
+
+		// otherwise they are bucketed by segment with a counting sort, which is linear where
+		// sorting many keys would cost more than the lookups it saves
+		auto bucket = [numSegments](size_t key) {
+			return std::min(key / segment_size, numSegments);
+		};
+		std::vector<size_t> bucketStart(numSegments + 2);
+		for (auto key : keys)
+			{
+				++bucketStart[bucket(key) + 1];
+			}
+		std::partial_sum(bucketStart.begin(), bucketStart.end(), bucketStart.begin());
+
+		std::vector<size_t> order(keys.size());
+		for (size_t i = 0; i < keys.size(); ++i)
+			{
+				order[bucketStart[bucket(keys[i])]++] = i;
+			}
+		for (auto i : order)
+			{
+				visit(keys[i], i);
+			}
+	}
+
+	// the first occupied index >= `index`, or end_index()
+	size_t next_occupied(size_t index) const
+	{
+		const auto& segments = alloc_and_storage.second();
+
+		while (index < end_index())
+			{
+				auto segment = segments[index / segment_size];
+				if (!segment)
+					{
+						// skip the whole segment
+						index = (index / segment_size + 1) * segment_size;
+						continue;
+					}
+				if (segment->has(index % segment_size))
+					{
+						return index;
+					}
+				++index;
+			}
+		return end_index();
+	}
+
+	// the last occupied index < `index`, or end_index() if there is none
+	size_t prev_occupied(size_t index) const
+	{
+		while (index-- > 0)
+			{
+				if (is_occupied(index))
+					{
+						return index;
+					}
+			}
+		return end_index();
+	}
+
+	// get the segment for `key`, allocating the directory entry and the segment if needed
+	internal_array_type& get_or_create_segment(size_t key)
+	{
+		size_t segment_id = key / segment_size;
+
+		auto& segments = alloc_and_storage.second();
+
+		// see if we need to grow the directory
+		if (segments.size() <= segment_id)
+			{
+				segments.resize(segment_id + 1);
+			}
+
+		auto arrayPtr = writable_segment(segment_id);
+		// see if we need to allocate a new array; it is only published once it is constructed
+		if (!arrayPtr)
+			{
+				arrayPtr = new internal_array_type;
+				segments.set(segment_id, arrayPtr);
+			}
+
+		return *arrayPtr;
+	}
+
+	void copy_segments_from(const segmented_map& other)
+	{
+		auto& segments = alloc_and_storage.second();
+		const auto& otherSegments = other.alloc_and_storage.second();
+
+		segments.resize(otherSegments.size());
+		for (size_t i = 0; i < otherSegments.size(); ++i)
+			{
+				auto segment = otherSegments[i];
+				if (!segment) continue;
+
+				segment->refs.fetch_add(1, std::memory_order_relaxed);
+				segments.set(i, segment);
+			}
+	}
+
+	// the segment `segment_id` (or nullptr), made private to this map first if it is shared with a
+	// copy
+	internal_array_type* writable_segment(size_t segment_id)
+	{
+		auto& segments = alloc_and_storage.second();
+		if (segment_id >= segments.size()) return nullptr;
+
+		auto segment = segments[segment_id];
+		if (!segment || segment->refs.load(std::memory_order_acquire) == 1) return segment;
+
+		auto copy = copy_segment(*segment);
+		release_segment(segment);
+		segments.set(segment_id, copy);
+		segment_copies.fetch_add(1, std::memory_order_relaxed);
+		return copy;
+	}
+
+	template <typename V = Value>
+	static std::enable_if_t<std::is_copy_constructible<V>::value, internal_array_type*> copy_segment(
+		const internal_array_type& segment)
+	{
+		return new internal_array_type(segment);
+	}
+
+	// move-only values are never shared, as the map can't be copied
+	template <typename V = Value>
+	static std::enable_if_t<!std::is_copy_constructible<V>::value, internal_array_type*>
+	copy_segment(const internal_array_type&)
+	{
+		std::terminate();
+	}
+
+	static void release_segment(internal_array_type* segment)
+	{
+		if (segment && segment->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete segment;
+	}
 };
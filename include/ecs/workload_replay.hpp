@@ -0,0 +1,152 @@
+/// @brief This defines replay_workload(), which runs a recorded workload_trace on a manager
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ecs/manager.hpp"
+#include "ecs/workload_trace.hpp"
+
+namespace ecs
+{
+/// @brief How many of each operation replay_workload() ran, and how long they took
+struct workload_replay_stats
+{
+	std::array<size_t, size_t(workload_op::count)> calls{};
+	std::array<std::chrono::nanoseconds, size_t(workload_op::count)> time{};
+	/// How many entities the queries visited
+	size_t entities_visited = 0;
+
+	std::chrono::nanoseconds total_time() const
+	{
+		std::chrono::nanoseconds ret{0};
+		for (auto t : time)
+			{
+				ret += t;
+			}
+		return ret;
+	}
+};
+
+/**
+ * @brief Runs the operations of \c trace on \c man, which may be a manager of another build or
+ * storage configuration than the one recorded. Entities are made with default constructed
+ * components, and the queries call a functor doing nothing but counting.
+ *
+ * The signatures are only known by name in the trace, so every signature and query it uses has
+ * to be in \c signatures, a boost::hana::tuple<> of them. Throws std::invalid_argument if one is
+ * missing.
+ */
+template <typename Manager, typename Signatures>
+workload_replay_stats replay_workload(Manager& man, const workload_trace& trace,
+									  Signatures signatures)
+{
+	using clock = std::chrono::steady_clock;
+
+	workload_replay_stats stats;
+	// the replayed entities, numbered like in the trace
+	std::vector<size_t> entities;
+	size_t visited = 0;
+	auto count = [&visited](auto&&...) { ++visited; };
+
+	// how to run an event, for every signature that can be replayed
+	std::unordered_map<std::string, std::function<void(const workload_event&)>> known;
+	boost::hana::for_each(signatures, [&](auto signature) {
+		using signature_t = decltype(signature);
+
+		auto run = [&man, &entities, &visited, count, signature,
+					cursor = query_cursor{}](const workload_event& event) mutable {
+			if (event.op == workload_op::run_all_matching)
+				{
+					man.run_all_matching(signature, count);
+					return;
+				}
+
+			if constexpr (decltype(Manager::isSignature(signature))::value)
+				{
+					auto components = boost::hana::transform(
+						Manager::isolate_storage_components(signature),
+						[](auto type) { return typename decltype(type)::type{}; });
+
+					switch (event.op)
+						{
+						case workload_op::new_entity:
+							entities.push_back(man.new_entity(signature).id);
+							return;
+						case workload_op::create_entity_batch:
+							for (auto& made :
+								 man.create_entity_batch(signature, components, event.argument))
+								{
+									entities.push_back(made.id);
+								}
+							return;
+						case workload_op::instantiate:
+							{
+								prefab<signature_t, decltype(components)> pf{signature, components};
+								auto first = man.instantiate(pf, event.argument);
+								for (size_t id = first; id < first + event.argument; ++id)
+									{
+										entities.push_back(id);
+									}
+								return;
+							}
+						case workload_op::run_some_matching:
+							{
+								query_budget budget;
+								budget.max_entities = event.argument;
+								man.run_some_matching(signature, cursor, count, budget);
+								return;
+							}
+						case workload_op::query:
+							visited += man.query(signature).size();
+							return;
+						default:
+							break;
+						}
+				}
+			throw std::invalid_argument("Can't replay this operation with " +
+										Manager::signature_name("", signature));
+		};
+		known.emplace(Manager::signature_name("", signature), std::move(run));
+	});
+
+	// the same, for every signature of the trace
+	std::vector<std::function<void(const workload_event&)>*> handlers;
+	for (const auto& name : trace.signatures)
+		{
+			auto iter = known.find(name);
+			if (iter == known.end())
+				{
+					throw std::invalid_argument("No signature " + name + " to replay with");
+				}
+			handlers.push_back(&iter->second);
+		}
+
+	for (const auto& event : trace.events)
+		{
+			auto start = clock::now();
+			if (event.op == workload_op::destroy_entity)
+				{
+					man.destroy_entity(entities.at(event.argument));
+				}
+			else
+				{
+					(*handlers[event.signature])(event);
+				}
+
+			auto op = size_t(event.op);
+			++stats.calls[op];
+			stats.time[op] += clock::now() - start;
+		}
+	stats.entities_visited = visited;
+	return stats;
+}
+}
@@ -0,0 +1,251 @@
+/// @brief This defines the recording of a manager's workload to a compact binary trace. See
+/// ecs/workload_replay.hpp to replay it
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ecs
+{
+/// @brief The operations a workload_recorder records
+enum class workload_op : std::uint8_t
+{
+	new_entity,
+	create_entity_batch,
+	instantiate,
+	destroy_entity,
+	run_all_matching,
+	run_some_matching,
+	query,
+	count
+};
+
+/// @brief One recorded call
+struct workload_event
+{
+	workload_op op;
+	/// The index of the call's signature in workload_trace::signatures (0 for destroy_entity)
+	std::uint32_t signature;
+	/**
+	 * The number of entities made for create_entity_batch and instantiate, the entity budget for
+	 * run_some_matching (the number of entities visited if it had a time budget), and for
+	 * destroy_entity the entity, numbered in the order the trace made them; 0 otherwise
+	 */
+	std::uint64_t argument;
+};
+
+/**
+ * @brief The structural operations and queries run on a manager, in order. Entities are numbered
+ * in the order they were made, not by ID, so a trace can be replayed on a manager allocating IDs
+ * differently. Component values aren't recorded, only which components were used.
+ */
+struct workload_trace
+{
+	/// The signatures (and queries) used, named like "<comp1, comp2>"
+	std::vector<std::string> signatures;
+	std::vector<workload_event> events;
+
+	/**
+	 * @brief Writes the trace in a compact binary format: every event takes one byte for the
+	 * operation, and a variable length integer for both the signature and the argument
+	 */
+	void write(std::ostream& stream) const
+	{
+		stream.write(magic, sizeof(magic));
+		write_varint(stream, version);
+
+		write_varint(stream, signatures.size());
+		for (const auto& signature : signatures)
+			{
+				write_varint(stream, signature.size());
+				stream.write(signature.data(), std::streamsize(signature.size()));
+			}
+
+		write_varint(stream, events.size());
+		for (const auto& event : events)
+			{
+				stream.put(char(event.op));
+				write_varint(stream, event.signature);
+				write_varint(stream, event.argument);
+			}
+	}
+
+	/// @brief Reads a trace written by write(). Throws std::runtime_error if it is malformed
+	static workload_trace read(std::istream& stream)
+	{
+		char header[sizeof(magic)];
+		if (!stream.read(header, sizeof(header)) ||
+			!std::equal(header, header + sizeof(header), magic) || read_varint(stream) != version)
+			{
+				throw std::runtime_error("Not a workload trace");
+			}
+
+		workload_trace ret;
+		ret.signatures.resize(read_varint(stream));
+		for (auto& signature : ret.signatures)
+			{
+				signature.resize(read_varint(stream));
+				if (!stream.read(&signature[0], std::streamsize(signature.size())))
+					{
+						throw std::runtime_error("Truncated workload trace");
+					}
+			}
+
+		ret.events.resize(read_varint(stream));
+		for (auto& event : ret.events)
+			{
+				auto op = stream.get();
+				if (op < 0 || op >= int(workload_op::count))
+					{
+						throw std::runtime_error("Bad operation in workload trace");
+					}
+				event.op = workload_op(op);
+				event.signature = std::uint32_t(read_varint(stream));
+				event.argument = read_varint(stream);
+				if (event.op != workload_op::destroy_entity &&
+					event.signature >= ret.signatures.size())
+					{
+						throw std::runtime_error("Bad signature in workload trace");
+					}
+			}
+		return ret;
+	}
+
+private:
+	static constexpr char magic[4] = {'E', 'C', 'S', 'W'};
+	static constexpr std::uint64_t version = 1;
+
+	// LEB128: 7 bits per byte, the high bit set on every byte but the last
+	static void write_varint(std::ostream& stream, std::uint64_t value)
+	{
+		while (value >= 0x80)
+			{
+				stream.put(char(value | 0x80));
+				value >>= 7;
+			}
+		stream.put(char(value));
+	}
+
+	static std::uint64_t read_varint(std::istream& stream)
+	{
+		std::uint64_t ret = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7)
+			{
+				auto byte = stream.get();
+				if (byte < 0) throw std::runtime_error("Truncated workload trace");
+
+				ret |= std::uint64_t(byte & 0x7f) << shift;
+				if (!(byte & 0x80)) return ret;
+			}
+		throw std::runtime_error("Bad integer in workload trace");
+	}
+};
+
+/**
+ * @brief Records the workload of a manager to a workload_trace; attach it with
+ * manager::record_workload(). The calls made on that manager are recorded, not those made on its
+ * bases or derived managers directly. Entities that existed before recording started aren't in
+ * the trace, and neither is their destruction. compact() and sort_entities() are followed, but not
+ * restore() and load_state().
+ */
+class workload_recorder
+{
+public:
+	/**
+	 * @brief Gets the index of the signature named by \c make_name in the trace, like
+	 * profiler::site_id(): \c make_name is only called the first time its type is seen
+	 */
+	template <typename F>
+	std::uint32_t signature_id(F&& make_name)
+	{
+		auto iter = signaturesByType.find(typeid(F));
+		if (iter != signaturesByType.end()) return iter->second;
+
+		auto name = std::forward<F>(make_name)();
+		auto byName = signaturesByName.find(name);
+		auto id = byName != signaturesByName.end() ? byName->second
+												   : std::uint32_t(recorded.signatures.size());
+		if (id == recorded.signatures.size())
+			{
+				recorded.signatures.push_back(name);
+				signaturesByName.emplace(std::move(name), id);
+			}
+		signaturesByType.emplace(typeid(F), id);
+		return id;
+	}
+
+	void record(workload_op op, std::uint32_t signature, std::uint64_t argument = 0)
+	{
+		recorded.events.push_back({op, signature, argument});
+	}
+
+	/// @brief Numbers the entity \c id, just made
+	void created(size_t id)
+	{
+		if (id >= numbers.size()) numbers.resize(id + 1, unnumbered);
+		numbers[id] = nextNumber++;
+	}
+
+	/// @brief Records the destruction of the entity \c id, if it was made while recording
+	void destroyed(size_t id)
+	{
+		if (id >= numbers.size() || numbers[id] == unnumbered) return;
+
+		record(workload_op::destroy_entity, 0, numbers[id]);
+		numbers[id] = unnumbered;
+	}
+
+	/// @brief Follows the entities moved by manager::remap_entities()
+	void remap_ids(const std::vector<size_t>& remap, size_t invalid)
+	{
+		std::vector<std::uint64_t> remapped;
+		for (size_t id = 0; id < numbers.size() && id < remap.size(); ++id)
+			{
+				if (numbers[id] == unnumbered || remap[id] == invalid) continue;
+
+				if (remap[id] >= remapped.size()) remapped.resize(remap[id] + 1, unnumbered);
+				remapped[remap[id]] = numbers[id];
+			}
+		numbers = std::move(remapped);
+	}
+
+	/// @brief Follows the entities moved by manager::permute_entities()
+	void move_ids(const std::vector<std::pair<size_t, size_t>>& moves)
+	{
+		std::vector<std::pair<size_t, std::uint64_t>> moved;
+		for (auto [from, to] : moves)
+			{
+				moved.emplace_back(to, from < numbers.size() ? numbers[from] : unnumbered);
+			}
+		for (auto [to, number] : moved)
+			{
+				if (to >= numbers.size()) numbers.resize(to + 1, unnumbered);
+				numbers[to] = number;
+			}
+	}
+
+	const workload_trace& trace() const { return recorded; }
+
+private:
+	static constexpr std::uint64_t unnumbered = std::numeric_limits<std::uint64_t>::max();
+
+	workload_trace recorded;
+	std::unordered_map<std::type_index, std::uint32_t> signaturesByType;
+	std::unordered_map<std::string, std::uint32_t> signaturesByName;
+
+	// the number of every entity made while recording, by ID
+	std::vector<std::uint64_t> numbers;
+	std::uint64_t nextNumber = 0;
+};
+}
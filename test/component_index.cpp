@@ -0,0 +1,204 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ecs/component_index.hpp>
+
+#include <set>
+
+using boost::hana::make_tuple;
+using boost::hana::type_c;
+using namespace ecs;
+
+namespace component_index_test
+{
+struct player_info
+{
+	int player_id;
+	float score;
+};
+struct item
+{
+	int template_id;
+};
+
+BOOST_AUTO_TEST_CASE(hash_index_test)
+{
+	auto man = create_manager(make_type_tuple<player_info, item>);
+	auto before = man.new_entity(make_type_tuple<player_info>, make_tuple(player_info{7, 0.f}));
+
+	hash_index<int> byPlayer{man, type_c<player_info>,
+							 [](const player_info& info) { return info.player_id; }};
+	hash_index<int> byTemplate{man, type_c<item>, [](const item& it) { return it.template_id; }};
+
+	// entities that were there before the index are indexed right away
+	BOOST_TEST(byPlayer.find(7) == before.id);
+
+	auto other = man.new_entity(make_type_tuple<player_info>, make_tuple(player_info{8, 0.f}));
+	for (int i = 0; i < 5; ++i)
+		{
+			man.new_entity(make_type_tuple<item>, make_tuple(item{i % 2}));
+		}
+
+	// the index catches up at the flush
+	BOOST_TEST(byPlayer.find(8) == invalid_entity);
+	man.flush_observers();
+	BOOST_TEST(byPlayer.find(8) == other.id);
+	BOOST_TEST(byTemplate.count(0) == 3);
+	BOOST_TEST(byTemplate.count(1) == 2);
+
+	man.get_storage_component(type_c<player_info>, other.id).player_id = 9;
+	man.mark_changed(type_c<player_info>, other.id);
+	man.destroy_entity(before.id);
+	man.flush_observers();
+
+	BOOST_TEST(byPlayer.find(7) == invalid_entity);
+	BOOST_TEST(byPlayer.find(8) == invalid_entity);
+	BOOST_TEST(byPlayer.find(9) == other.id);
+	BOOST_TEST(byPlayer.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(ordered_index_test)
+{
+	auto man = create_manager(make_type_tuple<player_info>);
+
+	ordered_index<float> byScore{man, type_c<player_info>,
+								 [](const player_info& info) { return info.score; }};
+
+	std::vector<size_t> ids;
+	for (int i = 0; i < 10; ++i)
+		{
+			ids.push_back(man.new_entity(make_type_tuple<player_info>,
+										 make_tuple(player_info{i, float(i * 10)}))
+							  .id);
+		}
+
+	// an ID destroyed and reused before the flush ends up filed under its new entity
+	man.destroy_entity(ids[3]);
+	auto reused = man.new_entity(make_type_tuple<player_info>, make_tuple(player_info{3, 35.f}));
+	BOOST_TEST(reused.id == ids[3]);
+	man.flush_observers();
+
+	std::vector<size_t> found;
+	auto range = byScore.range(20.f, 50.f);
+	for (auto iter = range.first; iter != range.second; ++iter)
+		{
+			found.push_back(iter->second);
+		}
+	BOOST_TEST(found == (std::vector<size_t>{ids[2], reused.id, ids[4]}));
+	BOOST_TEST(byScore.size() == 10);
+}
+
+BOOST_AUTO_TEST_CASE(shared_key_test)
+{
+	auto man = create_manager(make_type_tuple<item>);
+	hash_index<int> byTemplate{man, type_c<item>, [](const item& it) { return it.template_id; }};
+
+	// all the instances of a template share a key
+	std::vector<size_t> ids;
+	for (int i = 0; i < 1000; ++i)
+		{
+			ids.push_back(man.new_entity(make_type_tuple<item>, make_tuple(item{i % 2})).id);
+		}
+	for (size_t i = 0; i < ids.size(); i += 4)
+		{
+			man.destroy_entity(ids[i]);
+		}
+	man.flush_observers();
+
+	BOOST_TEST(byTemplate.count(0) == 250);
+	BOOST_TEST(byTemplate.count(1) == 500);
+	BOOST_TEST(byTemplate.size() == 750);
+
+	std::set<size_t> found;
+	auto range = byTemplate.equal_range(0);
+	for (auto iter = range.first; iter != range.second; ++iter)
+		{
+			BOOST_TEST(iter->first == 0);
+			found.insert(iter->second);
+		}
+	BOOST_TEST(found.size() == 250);
+	BOOST_TEST(found.count(ids[2]) == 1);
+	BOOST_TEST(found.count(ids[4]) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(renumber_test)
+{
+	auto man = create_manager(make_type_tuple<player_info>);
+	ordered_index<int> byPlayer{man, type_c<player_info>,
+								[](const player_info& info) { return info.player_id; }};
+
+	for (int i = 0; i < 10; ++i)
+		{
+			man.new_entity(make_type_tuple<player_info>,
+						   make_tuple(player_info{i, float(10 - i)}));
+		}
+	for (size_t id = 0; id < 9; ++id)
+		{
+			man.destroy_entity(id);
+		}
+
+	// the index follows the entities to their new IDs right away
+	auto remap = man.compact();
+	BOOST_TEST(remap[9] == 0);
+	BOOST_TEST(byPlayer.find(9) == 0);
+	BOOST_TEST(man.has_component(type_c<player_info>, byPlayer.find(9)));
+
+	for (int i = 0; i < 3; ++i)
+		{
+			man.new_entity(make_type_tuple<player_info>,
+						   make_tuple(player_info{20 + i, float(-i)}));
+		}
+	man.flush_observers();
+	man.sort_entities(make_type_tuple<player_info>,
+					  [](const player_info& info) { return info.score; });
+	for (auto elem : byPlayer)
+		{
+			BOOST_TEST(man.get_storage_component(type_c<player_info>, elem.second).player_id ==
+					   elem.first);
+		}
+	BOOST_TEST(byPlayer.find(22) == 0);
+	BOOST_TEST(byPlayer.size() == 4);
+}
+
+BOOST_AUTO_TEST_CASE(unregister_test)
+{
+	auto man = create_manager(make_type_tuple<item>);
+	{
+		hash_index<int> byTemplate{man, type_c<item>,
+								   [](const item& it) { return it.template_id; }};
+		auto copy = byTemplate;
+		BOOST_TEST(man.get_observers(type_c<item>).added.observers.size() == 1);
+	}
+
+	// nothing is kept for the index once it is gone
+	man.new_entity(make_type_tuple<item>, make_tuple(item{1}));
+	auto& events = man.get_observers(type_c<item>);
+	BOOST_TEST(events.added.observers.empty());
+	BOOST_TEST(events.added.pending.empty());
+	BOOST_TEST(events.renumbered.empty());
+}
+
+BOOST_AUTO_TEST_CASE(restore_test)
+{
+	auto man = create_manager(make_type_tuple<player_info>);
+	hash_index<int> byPlayer{man, type_c<player_info>,
+							 [](const player_info& info) { return info.player_id; }};
+
+	auto kept = man.new_entity(make_type_tuple<player_info>, make_tuple(player_info{1, 0.f}));
+	man.flush_observers();
+	auto snap = man.snapshot();
+
+	man.get_storage_component(type_c<player_info>, kept.id).player_id = 2;
+	man.mark_changed(type_c<player_info>, kept.id);
+	man.new_entity(make_type_tuple<player_info>, make_tuple(player_info{3, 0.f}));
+	man.flush_observers();
+	BOOST_TEST(byPlayer.find(2) == kept.id);
+
+	// the index catches up with the restore at the next flush
+	man.restore(snap);
+	man.flush_observers();
+	BOOST_TEST(byPlayer.find(1) == kept.id);
+	BOOST_TEST(byPlayer.count(2) == 0);
+	BOOST_TEST(byPlayer.count(3) == 0);
+	BOOST_TEST(byPlayer.size() == 1);
+}
+}
@@ -0,0 +1,176 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ecs/coroutine_system.hpp>
+
+#include <string>
+#include <vector>
+
+using boost::hana::make_tuple;
+using boost::hana::type_c;
+using namespace ecs;
+
+namespace coroutine_system
+{
+struct position
+{
+	float x, y;
+};
+struct velocity
+{
+	float x, y;
+};
+
+using game_manager = manager<decltype(make_type_tuple<position, velocity>)>;
+}
+
+template <>
+struct ecs::manager_data<coroutine_system::game_manager>
+{
+	int moved = 0;
+	// where slice() left off, kept between the frames it is spawned in
+	ecs::query_cursor cursor;
+};
+
+namespace coroutine_system
+{
+system_task integrate(game_manager& man)
+{
+	return run_all_matching_async(man, make_type_tuple<position, velocity>,
+								  [&man](position& pos, const velocity& vel) {
+									  pos.x += vel.x;
+									  ++man.get_manager_data().moved;
+								  },
+								  10);
+}
+
+// moves at most 10 entities per frame, picking up where the last frame left off
+system_task slice(game_manager& man)
+{
+	auto& data = man.get_manager_data();
+	query_budget budget;
+	budget.max_entities = 10;
+	man.run_some_matching(make_type_tuple<position, velocity>, data.cursor,
+						  [&data](position& pos, const velocity& vel) {
+							  pos.x += vel.x;
+							  ++data.moved;
+						  },
+						  budget);
+	co_return;
+}
+
+system_task logger(std::string& log, char name, int steps)
+{
+	for (int i = 0; i < steps; ++i)
+		{
+			log += name;
+			co_await yield_now{};
+		}
+	co_await sync_barrier{};
+	log += '|';
+}
+
+BOOST_AUTO_TEST_CASE(batched_query_test)
+{
+	game_manager man;
+	for (int i = 0; i < 35; ++i)
+		{
+			man.new_entity(make_type_tuple<position, velocity>,
+						   make_tuple(position{0.f, 0.f}, velocity{1.f, 0.f}));
+		}
+
+	system_scheduler scheduler;
+	scheduler.spawn(integrate(man));
+
+	BOOST_TEST(man.get_manager_data().moved == 0);
+	BOOST_TEST(scheduler.step());
+	BOOST_TEST(man.get_manager_data().moved == 10);
+	BOOST_TEST(scheduler.step());
+	BOOST_TEST(scheduler.step());
+	BOOST_TEST(man.get_manager_data().moved == 30);
+	BOOST_TEST(!scheduler.step());
+	BOOST_TEST(man.get_manager_data().moved == 35);
+}
+
+BOOST_AUTO_TEST_CASE(empty_batch_test)
+{
+	game_manager man;
+	for (int i = 0; i < 3; ++i)
+		{
+			man.new_entity(make_type_tuple<position, velocity>);
+		}
+
+	// batches of 0 still move one entity per step
+	system_scheduler scheduler;
+	scheduler.spawn(run_all_matching_async(man, make_type_tuple<position, velocity>,
+										   [&man](position&, const velocity&) {
+											   ++man.get_manager_data().moved;
+										   },
+										   0));
+	scheduler.run();
+	BOOST_TEST(man.get_manager_data().moved == 3);
+}
+
+BOOST_AUTO_TEST_CASE(manager_data_test)
+{
+	game_manager man;
+	std::vector<game_manager::entity> entities;
+	for (int i = 0; i < 25; ++i)
+		{
+			entities.push_back(man.new_entity(make_type_tuple<position, velocity>,
+											  make_tuple(position{0.f, 0.f}, velocity{1.f, 0.f})));
+		}
+
+	// a new system every frame, with its state in the manager_data
+	system_scheduler scheduler;
+	for (int frame = 0; frame < 3; ++frame)
+		{
+			scheduler.spawn(slice(man));
+			scheduler.run();
+		}
+	BOOST_TEST(man.get_manager_data().moved == 25);
+	BOOST_TEST(man.get_manager_data().cursor.passes == 1);
+	for (auto ent : entities)
+		{
+			BOOST_TEST(man.get_storage_component(type_c<position>, ent.id).x == 1.f);
+		}
+
+	scheduler.spawn(slice(man));
+	scheduler.run();
+	BOOST_TEST(man.get_manager_data().moved == 35);
+	BOOST_TEST(man.get_storage_component(type_c<position>, entities[9].id).x == 2.f);
+	BOOST_TEST(man.get_storage_component(type_c<position>, entities[10].id).x == 1.f);
+}
+
+BOOST_AUTO_TEST_CASE(barrier_test)
+{
+	std::string log;
+
+	system_scheduler scheduler;
+	scheduler.spawn(logger(log, 'a', 1));
+	scheduler.spawn(logger(log, 'b', 3));
+	scheduler.run();
+
+	// a waits at the barrier until b got there too
+	BOOST_TEST(log == "abbb||");
+}
+
+BOOST_AUTO_TEST_CASE(frame_pool_test)
+{
+	game_manager man;
+	man.new_entity(make_type_tuple<position, velocity>);
+
+	system_scheduler scheduler;
+	scheduler.spawn(integrate(man));
+	scheduler.run();
+
+	// running the same systems again reuses the frames
+	auto allocated = ecs::detail::frame_pool::local().blocks_allocated();
+	for (int i = 0; i < 10; ++i)
+		{
+			scheduler.spawn(integrate(man));
+			scheduler.run();
+		}
+	BOOST_TEST(ecs::detail::frame_pool::local().blocks_allocated() == allocated);
+	BOOST_TEST(man.get_manager_data().moved == 11);
+}
+}
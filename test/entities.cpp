@@ -0,0 +1,813 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ecs/manager.hpp>
+
+#include <cstdint>
+#include <stdexcept>
+#include <set>
+#include <thread>
+
+using boost::hana::make_tuple;
+using boost::hana::type_c;
+using namespace ecs;
+
+namespace entities
+{
+struct position
+{
+	float x, y;
+};
+struct velocity
+{
+	float x, y;
+};
+struct player
+{
+};
+
+BOOST_AUTO_TEST_CASE(new_entity_test)
+{
+	auto man = create_manager(make_type_tuple<position, velocity, player>);
+
+	auto ent = man.new_entity(make_type_tuple<position, player>, make_tuple(position{1.f, 2.f}));
+
+	BOOST_TEST(man.has_component(type_c<position>, ent));
+	BOOST_TEST(man.has_component(type_c<player>, ent));
+	BOOST_TEST(!man.has_component(type_c<velocity>, ent));
+
+	BOOST_TEST(man.get_storage_component(type_c<position>, ent.id).y == 2.f);
+}
+
+BOOST_AUTO_TEST_CASE(destroy_entity_test)
+{
+	auto man = create_manager(make_type_tuple<position, velocity>);
+
+	auto first = man.new_entity(make_type_tuple<position>);
+	auto second = man.new_entity(make_type_tuple<position, velocity>);
+
+	second.destroy();
+	BOOST_TEST(!man.has_component(type_c<position>, second));
+	BOOST_TEST(man.has_component(type_c<position>, first));
+
+	// IDs get reused
+	auto third = man.new_entity(make_type_tuple<velocity>);
+	BOOST_TEST(third.id == second.id);
+	BOOST_TEST(!man.has_component(type_c<position>, third));
+}
+
+BOOST_AUTO_TEST_CASE(run_all_matching_test)
+{
+	auto man = create_manager(make_type_tuple<position, velocity>);
+
+	for (int i = 0; i < 100; ++i)
+		{
+			if (i % 2 == 0)
+				{
+					man.new_entity(make_type_tuple<position, velocity>,
+								   make_tuple(position{float(i), 0.f}, velocity{1.f, 1.f}));
+				}
+			else
+				{
+					man.new_entity(make_type_tuple<position>, make_tuple(position{float(i), 0.f}));
+				}
+		}
+
+	size_t count = 0;
+	man.run_all_matching(make_type_tuple<position, velocity>,
+						 [&count](position& pos, velocity& vel) {
+							 pos.y += vel.y;
+							 ++count;
+						 });
+	BOOST_TEST(count == 50);
+
+	float total = 0.f;
+	man.run_all_matching(make_type_tuple<position>,
+						 [&total](const position& pos) { total += pos.y; });
+	BOOST_TEST(total == 50.f);
+}
+
+BOOST_AUTO_TEST_CASE(hierarchy_test)
+{
+	auto base = create_manager(make_type_tuple<position>);
+	auto derived = create_manager(make_type_tuple<velocity>, make_tuple(&base));
+
+	auto ent = derived.new_entity(make_type_tuple<position, velocity>);
+	auto baseOnly = base.new_entity(make_type_tuple<position>);
+
+	BOOST_TEST(ent.id != baseOnly.id);
+	BOOST_TEST(derived.has_component(type_c<position>, ent));
+	BOOST_TEST(base.has_component(type_c<position>, ent.id));
+
+	size_t count = 0;
+	derived.run_all_matching(make_type_tuple<position>, [&count](position&) { ++count; });
+	BOOST_TEST(count == 2);
+
+	count = 0;
+	derived.run_all_matching(make_type_tuple<position, velocity>,
+							 [&count](position&, velocity&) { ++count; });
+	BOOST_TEST(count == 1);
+
+	derived.destroy_entity(ent.id);
+	BOOST_TEST(!base.has_component(type_c<position>, ent.id));
+}
+
+BOOST_AUTO_TEST_CASE(compact_test)
+{
+	auto base = create_manager(make_type_tuple<position>);
+	auto man = create_manager(make_type_tuple<velocity>, make_tuple(&base));
+
+	std::vector<size_t> ids;
+	for (int i = 0; i < 1000; ++i)
+		{
+			ids.push_back(man.new_entity(make_type_tuple<position, velocity>,
+										 make_tuple(position{float(i), 0.f}, velocity{0.f, 0.f}))
+							  .id);
+		}
+	for (int i = 0; i < 1000; ++i)
+		{
+			if (i % 3 != 0) man.destroy_entity(ids[i]);
+		}
+	auto segmentsBefore = base.memory_stats().components[0].storage.segments_allocated;
+
+	auto remap = man.compact();
+
+	for (int i = 0; i < 1000; ++i)
+		{
+			if (i % 3 != 0)
+				{
+					BOOST_TEST(remap[ids[i]] == invalid_entity);
+					continue;
+				}
+			BOOST_TEST(remap[ids[i]] == size_t(i / 3));
+			BOOST_TEST(man.get_storage_component(type_c<position>, remap[ids[i]]).x == float(i));
+			BOOST_TEST(man.has_component(type_c<velocity>, remap[ids[i]]));
+		}
+	BOOST_TEST(base.memory_stats().components[0].storage.segments_allocated < segmentsBefore);
+
+	size_t count = 0;
+	man.run_all_matching(make_type_tuple<position, velocity>,
+						 [&count](position&, velocity&) { ++count; });
+	BOOST_TEST(count == 334);
+
+	// new IDs continue after the compacted range
+	BOOST_TEST(man.new_entity(make_type_tuple<velocity>).id == 334);
+}
+
+BOOST_AUTO_TEST_CASE(sort_entities_test)
+{
+	auto man = create_manager(make_type_tuple<position, velocity>);
+
+	// created in reverse order of x, plus an entity the sort must not touch
+	for (int i = 0; i < 200; ++i)
+		{
+			auto x = float(200 - i);
+			man.new_entity(make_type_tuple<position, velocity>,
+						   make_tuple(position{x, 0.f}, velocity{x, 0.f}));
+		}
+	auto unsorted = man.new_entity(make_type_tuple<velocity>, make_tuple(velocity{-1.f, 0.f}));
+
+	auto byX = [](const position& pos, const velocity&) { return pos.x; };
+	auto isSorted = [&man] {
+		std::vector<float> xs;
+		man.run_all_matching(make_type_tuple<position, velocity>,
+							 [&xs](const position& pos, const velocity& vel) {
+								 BOOST_TEST(pos.x == vel.x);
+								 xs.push_back(pos.x);
+							 });
+		return std::is_sorted(xs.begin(), xs.end());
+	};
+
+	BOOST_TEST(!man.sort_entities(make_type_tuple<position, velocity>, byX).empty());
+	BOOST_TEST(isSorted());
+	BOOST_TEST(man.get_storage_component(type_c<velocity>, unsorted.id).x == -1.f);
+
+	// sorting again does nothing
+	BOOST_TEST(man.sort_entities(make_type_tuple<position, velocity>, byX).empty());
+
+	// move one entity to the other end; only the entities in between shift
+	man.get_storage_component(type_c<position>, 10).x = 1000.f;
+	man.get_storage_component(type_c<velocity>, 10).x = 1000.f;
+	auto moves = man.sort_entities(make_type_tuple<position, velocity>, byX);
+	BOOST_TEST(isSorted());
+	BOOST_TEST(moves.size() == 190);
+
+	// the lists of which entities have which component followed the moves
+	for (size_t id = 0; id < 200; id += 2)
+		{
+			man.destroy_entity(id);
+		}
+	auto positions = man.get_entity_list(type_c<position>);
+	std::sort(positions.begin(), positions.end());
+	BOOST_TEST(positions.size() == 100);
+	for (size_t i = 0; i < positions.size(); ++i)
+		{
+			BOOST_TEST(positions[i] == 2 * i + 1);
+		}
+	BOOST_TEST(man.get_entity_list(type_c<velocity>).size() == 101);
+}
+
+BOOST_AUTO_TEST_CASE(run_some_matching_test)
+{
+	auto man = create_manager(make_type_tuple<position, velocity>);
+
+	for (int i = 0; i < 100; ++i)
+		{
+			man.new_entity(make_type_tuple<position, velocity>);
+		}
+
+	query_budget budget;
+	budget.max_entities = 30;
+	query_cursor cursor;
+
+	auto visit = [](position& pos, velocity&) { pos.x += 1.f; };
+	BOOST_TEST(!man.run_some_matching(make_type_tuple<position, velocity>, cursor, visit, budget));
+	BOOST_TEST(!man.run_some_matching(make_type_tuple<position, velocity>, cursor, visit, budget));
+
+	// structural changes in between: one entity behind the cursor and one ahead of it go away,
+	// and a new one takes the ID behind the cursor
+	man.destroy_entity(90);
+	man.destroy_entity(10);
+	man.new_entity(make_type_tuple<position, velocity>);
+
+	bool finished = false;
+	int calls = 0;
+	while (!finished)
+		{
+			finished = man.run_some_matching(make_type_tuple<position, velocity>, cursor, visit,
+											 budget);
+			++calls;
+		}
+	BOOST_TEST(calls == 2);
+	BOOST_TEST(cursor.passes == 1);
+
+	// every entity got visited exactly once, except the new one, which comes in the next pass
+	int visitedOnce = 0, notVisited = 0;
+	man.run_all_matching(make_type_tuple<position, velocity>,
+						 [&](const position& pos, const velocity&) {
+							 if (pos.x == 1.f) ++visitedOnce;
+							 if (pos.x == 0.f) ++notVisited;
+						 });
+	BOOST_TEST(visitedOnce == 98);
+	BOOST_TEST(notVisited == 1);
+
+	// without a limit, a pass finishes in one call
+	BOOST_TEST(man.run_some_matching(make_type_tuple<position, velocity>, cursor, visit,
+									 query_budget{}));
+	// an empty budget still visits one entity, so the pass gets done
+	budget.max_entities = 0;
+	calls = 0;
+	while (!man.run_some_matching(make_type_tuple<position, velocity>, cursor, visit, budget))
+		{
+			++calls;
+		}
+	BOOST_TEST(calls == 98);
+}
+
+BOOST_AUTO_TEST_CASE(spawner_test)
+{
+	auto man = create_manager(make_type_tuple<position, velocity>);
+	auto first = man.new_entity(make_type_tuple<position>, make_tuple(position{-1.f, 0.f}));
+
+	constexpr int numThreads = 4, perThread = 1000;
+
+	std::vector<decltype(man.make_spawner())> spawners;
+	for (int i = 0; i < numThreads; ++i)
+		{
+			spawners.push_back(man.make_spawner(64));
+		}
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < numThreads; ++i)
+		{
+			threads.emplace_back([&spawner = spawners[i], i] {
+				for (int j = 0; j < perThread; ++j)
+					{
+						spawner.new_entity(make_type_tuple<position, velocity>,
+										   make_tuple(position{float(i), float(j)}, velocity{}));
+					}
+			});
+		}
+	for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+	// nothing is visible before the merge
+	size_t count = 0;
+	man.run_all_matching(make_type_tuple<position>, [&count](const position&) { ++count; });
+	BOOST_TEST(count == 1);
+
+	for (auto& spawner : spawners)
+		{
+			BOOST_TEST(spawner.size() == perThread);
+			man.merge_spawned(spawner);
+			BOOST_TEST(spawner.size() == 0);
+		}
+
+	std::set<std::pair<float, float>> seen;
+	man.run_all_matching(make_type_tuple<position, velocity>,
+						 [&seen](const position& pos, const velocity&) {
+							 seen.emplace(pos.x, pos.y);
+						 });
+	BOOST_TEST(seen.size() == numThreads * perThread);
+	BOOST_TEST(man.get_storage_component(type_c<position>, first.id).x == -1.f);
+
+	// the spawned entities are regular entities from now on
+	auto next = man.new_entity(make_type_tuple<position>);
+	BOOST_TEST(!man.has_component(type_c<velocity>, next));
+	man.destroy_entity(0);
+	BOOST_TEST(!man.has_component(type_c<position>, first));
+
+	// the spawners still hold IDs, which compacting could give out again
+	BOOST_CHECK_THROW(man.compact(), std::logic_error);
+	auto moved = std::move(spawners.front());
+	spawners.clear();
+	BOOST_CHECK_THROW(man.compact(), std::logic_error);
+	moved.new_entity(make_type_tuple<position>);
+	man.merge_spawned(moved);
+	{
+		auto unused = std::move(moved);
+	}
+	BOOST_TEST(man.compact().size() > numThreads * perThread);
+	BOOST_TEST(man.component_count(type_c<velocity>) == numThreads * perThread);
+}
+
+BOOST_AUTO_TEST_CASE(driver_test)
+{
+	auto base = create_manager(make_type_tuple<position>);
+	auto derived = create_manager(make_type_tuple<velocity, player>, make_tuple(&base));
+
+	std::vector<size_t> players;
+	for (int i = 0; i < 10000; ++i)
+		{
+			if (i % 1000 == 7)
+				{
+					players.push_back(derived
+										  .new_entity(make_type_tuple<position, player>,
+													  make_tuple(position{float(i), 0.f}))
+										  .id);
+				}
+			else
+				{
+					derived.new_entity(make_type_tuple<position, velocity>);
+				}
+		}
+	// a player without a position, which the driver list has but the query mustn't match
+	derived.new_entity(make_type_tuple<player>);
+
+	BOOST_TEST(derived.component_count(type_c<position>) == 10000);
+	BOOST_TEST(derived.component_count(type_c<player>) == 11);
+
+	// the players are few enough to drive the query, and are still visited in ID order
+	BOOST_TEST(derived.find_driver(make_type_tuple<position, player>) != nullptr);
+	BOOST_TEST(derived.find_driver(make_type_tuple<position, velocity>) == nullptr);
+
+	std::vector<size_t> visited;
+	derived.run_all_matching(make_type_tuple<player, position>,
+							 [&](position& pos) { visited.push_back(size_t(pos.x)); });
+	BOOST_TEST(visited == players);
+	BOOST_TEST(derived.query(make_type_tuple<position, player>).ids() == players);
+}
+
+struct health
+{
+	int value;
+};
+
+BOOST_AUTO_TEST_CASE(query_terms_test)
+{
+	auto base = create_manager(make_type_tuple<position, velocity>);
+	auto derived = create_manager(make_type_tuple<player, health>, make_tuple(&base));
+
+	auto still = base.new_entity(make_type_tuple<position>).id;
+	auto moving = base.new_entity(make_type_tuple<position, velocity>,
+								  make_tuple(position{}, velocity{1.f, 2.f}))
+					  .id;
+	auto hero = derived.new_entity(make_type_tuple<position, velocity, player, health>,
+								   make_tuple(position{}, velocity{3.f, 4.f}, health{10}))
+					.id;
+
+	// exclusions the walked manager can see are part of the signature compare...
+	size_t count = 0;
+	derived.run_all_matching(make_type_tuple<position, without<velocity>>,
+							 [&count](position&) { ++count; });
+	BOOST_TEST(count == 1);
+
+	// ...and the ones of derived managers are asked for, so entities made on the base count too
+	count = 0;
+	derived.run_all_matching(make_type_tuple<position, without<player>>,
+							 [&count](position&) { ++count; });
+	BOOST_TEST(count == 2);
+
+	// one pass instead of one per combination: the optional components come as pointers
+	std::vector<const velocity*> velocities;
+	std::vector<const health*> healths;
+	derived.run_all_matching(make_type_tuple<optional<velocity>, position, optional<health>>,
+							 [&](velocity* vel, position&, health* hp) {
+								 velocities.push_back(vel);
+								 healths.push_back(hp);
+							 });
+	BOOST_TEST(velocities.size() == 3);
+	BOOST_TEST(velocities[still] == nullptr);
+	BOOST_TEST(velocities[moving]->y == 2.f);
+	BOOST_TEST(velocities[hero]->y == 4.f);
+	BOOST_TEST(healths[still] == nullptr);
+	BOOST_TEST(healths[moving] == nullptr);
+	BOOST_TEST(healths[hero]->value == 10);
+}
+
+BOOST_AUTO_TEST_CASE(gather_scatter_test)
+{
+	auto base = create_manager(make_type_tuple<position>);
+	auto derived = create_manager(make_type_tuple<velocity>, make_tuple(&base));
+
+	for (int i = 0; i < 3000; ++i)
+		{
+			derived.new_entity(make_type_tuple<position, velocity>,
+							   make_tuple(position{float(i), 0.f}, velocity{}));
+		}
+
+	// a hit list, in no particular order
+	std::vector<size_t> hits{2999, 17, 1500, 3};
+	std::vector<position> positions(hits.size());
+	derived.gather(type_c<position>, hits, positions.data());
+	BOOST_TEST(positions[0].x == 2999.f);
+	BOOST_TEST(positions[3].x == 3.f);
+
+	for (auto& pos : positions)
+		{
+			pos.y = -pos.x;
+		}
+	derived.scatter(type_c<position>, hits, positions.begin());
+	BOOST_TEST(base.get_storage_component(type_c<position>, 1500).y == -1500.f);
+	BOOST_TEST(base.get_storage_component(type_c<position>, 16).y == 0.f);
+}
+
+BOOST_AUTO_TEST_CASE(index_type_test)
+{
+	auto base = create_manager<std::uint32_t>(make_type_tuple<position>);
+	auto derived = create_manager(make_type_tuple<velocity, player>, make_tuple(&base));
+	static_assert(std::is_same<decltype(derived)::index_type, std::uint32_t>::value);
+
+	auto wide = create_manager(make_type_tuple<position>);
+	static_assert(std::is_same<decltype(wide)::index_type, size_t>::value);
+
+	std::vector<size_t> ids;
+	for (int i = 0; i < 3000; ++i)
+		{
+			if (i % 100 == 5)
+				{
+					ids.push_back(derived
+									  .new_entity(make_type_tuple<position, player>,
+												  make_tuple(position{float(i), 0.f}))
+									  .id);
+				}
+			else
+				{
+					derived.new_entity(make_type_tuple<position, velocity>,
+									   make_tuple(position{float(i), 0.f}, velocity{}));
+				}
+			wide.new_entity(make_type_tuple<position>);
+		}
+
+	// the lists of which entities have which component take half the memory
+	BOOST_TEST(base.memory_stats().components[0].entity_list_bytes * 2 ==
+			   wide.memory_stats().components[0].entity_list_bytes);
+
+	// queries driven by the entity lists and the signature table both still work
+	BOOST_TEST(derived.find_driver(make_type_tuple<position, player>) != nullptr);
+	auto players = derived.query(make_type_tuple<position, player>);
+	BOOST_TEST(std::vector<size_t>(players.ids().begin(), players.ids().end()) == ids);
+	BOOST_TEST(derived.query(make_type_tuple<position, velocity>).size() == 3000 - ids.size());
+
+	// compacting renumbers with the size_t table handles use
+	for (size_t i = 0; i < 3000; i += 2)
+		{
+			derived.destroy_entity(i);
+		}
+	auto remap = derived.compact();
+	BOOST_TEST(remap[ids[0]] == 2);
+	BOOST_TEST(derived.get_storage_component(type_c<position>, 2).x == 5.f);
+	BOOST_TEST(derived.has_component(type_c<player>, 2));
+
+	std::vector<size_t> hits{1499, 2};
+	std::vector<position> positions(hits.size());
+	derived.gather(type_c<position>, hits, positions.begin());
+	BOOST_TEST(positions[0].x == 2999.f);
+	BOOST_TEST(positions[1].x == 5.f);
+
+	// running out of IDs throws in every build type, and doesn't use up the IDs it couldn't give
+	auto narrow = create_manager<std::uint8_t>(make_type_tuple<position>);
+	narrow.create_entity_batch(make_type_tuple<position>, make_tuple(position{}), 250);
+	auto prefab = narrow.make_prefab(make_type_tuple<position>, 0);
+	BOOST_CHECK_THROW(narrow.instantiate(prefab, 10), std::length_error);
+	BOOST_TEST(narrow.instantiate(prefab, 5) == 250);
+	BOOST_CHECK_THROW(narrow.new_entity(make_type_tuple<position>), std::length_error);
+	BOOST_TEST(narrow.query(make_type_tuple<position>).size() == 255);
+}
+
+BOOST_AUTO_TEST_CASE(columnar_batch_test)
+{
+	auto base = create_manager(make_type_tuple<position>);
+	auto derived = create_manager(make_type_tuple<velocity, player>, make_tuple(&base));
+	derived.new_entity(make_type_tuple<position>);
+
+	constexpr size_t count = 3 * decltype(derived)::bulk_load_chunk_size / 2;
+	std::vector<position> positions(count);
+	std::vector<velocity> velocities(count);
+	for (size_t i = 0; i < count; ++i)
+		{
+			positions[i] = {float(i), 0.f};
+			velocities[i] = {0.f, float(i)};
+		}
+
+	std::vector<size_t> reported;
+	auto first = derived.create_entity_batch(
+		make_type_tuple<position, player, velocity>,
+		make_tuple(make_column(positions), make_column(velocities)),
+		[&reported](size_t done, size_t total) {
+			if (total == count) reported.push_back(done);
+		});
+	BOOST_TEST(first == 1);
+	BOOST_TEST(reported == (std::vector<size_t>{count * 2 / 3, count}));
+
+	BOOST_TEST(derived.component_count(type_c<player>) == count);
+	BOOST_TEST(base.component_count(type_c<position>) == count + 1);
+	BOOST_TEST(derived.get_storage_component(type_c<position>, first + 1234).x == 1234.f);
+	BOOST_TEST(derived.get_storage_component(type_c<velocity>, first + count - 1).y ==
+			   float(count - 1));
+
+	size_t matched = 0;
+	derived.run_all_matching(make_type_tuple<position, velocity, player>,
+							 [&matched](position& p, velocity& v) { matched += p.x == v.y; });
+	BOOST_TEST(matched == count);
+}
+
+BOOST_AUTO_TEST_CASE(observers_test)
+{
+	auto base = create_manager(make_type_tuple<position>);
+	auto derived = create_manager(make_type_tuple<velocity, player>, make_tuple(&base));
+
+	std::vector<size_t> added, changed, removed, players;
+	size_t calls = 0;
+	derived.on_add(type_c<position>, [&](const std::vector<size_t>& ids) {
+		added.insert(added.end(), ids.begin(), ids.end());
+		++calls;
+	});
+	derived.on_change(type_c<position>, [&](const std::vector<size_t>& ids) { changed = ids; });
+	derived.on_remove(type_c<position>, [&](const std::vector<size_t>& ids) { removed = ids; });
+	derived.on_add(type_c<player>, [&](const std::vector<size_t>& ids) { players = ids; });
+
+	auto first = derived.new_entity(make_type_tuple<position, velocity>);
+	auto second = derived.new_entity(make_type_tuple<position, player>);
+	derived.new_entity(make_type_tuple<velocity>);
+	derived.mark_changed(type_c<position>, first.id);
+	derived.destroy_entity(second.id);
+
+	// nothing happens until the flush, and then it is one call per event kind
+	BOOST_TEST(calls == 0);
+	derived.flush_observers();
+	BOOST_TEST(calls == 1);
+	BOOST_TEST(added == (std::vector<size_t>{first.id, second.id}));
+	BOOST_TEST(changed == (std::vector<size_t>{first.id}));
+	BOOST_TEST(removed == (std::vector<size_t>{second.id}));
+	BOOST_TEST(players == (std::vector<size_t>{second.id}));
+
+	// the events are gone after the flush
+	derived.flush_observers();
+	BOOST_TEST(calls == 1);
+}
+
+BOOST_AUTO_TEST_CASE(prefab_test)
+{
+	auto base = create_manager(make_type_tuple<position>);
+	auto derived = create_manager(make_type_tuple<velocity, player>, make_tuple(&base));
+
+	auto original = derived.new_entity(make_type_tuple<position, velocity, player>,
+									   make_tuple(position{1.f, 2.f}, velocity{3.f, 4.f}));
+	auto pf = derived.make_prefab(make_type_tuple<position, velocity, player>, original.id);
+
+	std::vector<size_t> added;
+	derived.on_add(type_c<position>, [&added](const std::vector<size_t>& ids) { added = ids; });
+
+	auto first = derived.instantiate(pf, 1000);
+	for (size_t id = first; id < first + 1000; ++id)
+		{
+			BOOST_TEST(derived.get_storage_component(type_c<velocity>, id).y == 4.f);
+			BOOST_TEST(base.get_storage_component(type_c<position>, id).x == 1.f);
+			BOOST_TEST(derived.has_component(type_c<player>, id));
+		}
+
+	size_t count = 0;
+	derived.run_all_matching(make_type_tuple<position, velocity>,
+							 [&count](position&, velocity&) { ++count; });
+	BOOST_TEST(count == 1001);
+
+	derived.flush_observers();
+	BOOST_TEST(added.size() == 1000);
+
+	// the copies are regular entities
+	derived.destroy_entity(first + 10);
+	BOOST_TEST(!base.has_component(type_c<position>, first + 10));
+	BOOST_TEST(derived.new_entity(make_type_tuple<position>).id == first + 10);
+}
+
+struct copy_counted
+{
+	static int copies;
+
+	copy_counted() = default;
+	copy_counted(const copy_counted&) { ++copies; }
+	copy_counted(copy_counted&&) = default;
+	copy_counted& operator=(const copy_counted&)
+	{
+		++copies;
+		return *this;
+	}
+	copy_counted& operator=(copy_counted&&) = default;
+
+	// not empty, so it isn't a tag component
+	int value = 0;
+};
+int copy_counted::copies = 0;
+
+BOOST_AUTO_TEST_CASE(move_into_storage_test)
+{
+	auto man = create_manager(make_type_tuple<position, copy_counted>);
+
+	copy_counted::copies = 0;
+	man.new_entity(make_type_tuple<position, copy_counted>,
+				   make_tuple(position{1.f, 2.f}, copy_counted{}));
+	man.new_entity(make_type_tuple<copy_counted>);
+	BOOST_TEST(copy_counted::copies == 0);
+
+	auto spawner = man.make_spawner();
+	spawner.new_entity(make_type_tuple<copy_counted>, make_tuple(copy_counted{}));
+	man.merge_spawned(spawner);
+	BOOST_TEST(copy_counted::copies == 0);
+
+	// lvalues are still copied
+	auto components = make_tuple(copy_counted{});
+	man.new_entity(make_type_tuple<copy_counted>, components);
+	BOOST_TEST(copy_counted::copies == 1);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_test)
+{
+	auto base = create_manager(make_type_tuple<position>);
+	auto derived = create_manager(make_type_tuple<velocity, player>, make_tuple(&base));
+
+	auto kept = derived.new_entity(make_type_tuple<position, velocity>,
+								   make_tuple(position{1.f, 2.f}, velocity{3.f, 4.f}));
+	auto destroyed = derived.new_entity(make_type_tuple<position, player>,
+										make_tuple(position{5.f, 6.f}));
+
+	auto snap = derived.snapshot();
+
+	std::vector<size_t> added, changed, removed;
+	derived.on_add(type_c<position>, [&](const std::vector<size_t>& ids) { added = ids; });
+	derived.on_change(type_c<position>, [&](const std::vector<size_t>& ids) { changed = ids; });
+	derived.on_remove(type_c<position>, [&](const std::vector<size_t>& ids) { removed = ids; });
+
+	// play a few frames
+	base.get_storage_component(type_c<position>, kept.id).x = 10.f;
+	auto made = derived.new_entity(make_type_tuple<position>);
+	derived.destroy_entity(destroyed.id);
+	auto renumbers = derived.renumber_count();
+
+	derived.restore(snap);
+	BOOST_TEST(base.get_storage_component(type_c<position>, kept.id).x == 1.f);
+	BOOST_TEST(derived.get_storage_component(type_c<velocity>, kept.id).y == 4.f);
+	BOOST_TEST(base.get_storage_component(type_c<position>, destroyed.id).y == 6.f);
+	BOOST_TEST(derived.has_component(type_c<player>, destroyed.id));
+	BOOST_TEST(derived.renumber_count() != renumbers);
+
+	size_t count = 0;
+	derived.run_all_matching(make_type_tuple<position>, [&count](position&) { ++count; });
+	BOOST_TEST(count == 2);
+
+	// the observers hear about the difference, not about the frames rolled back
+	derived.flush_observers();
+	BOOST_TEST(added.size() == 1);
+	BOOST_TEST(added[0] == destroyed.id);
+	BOOST_TEST(changed == (std::vector<size_t>{kept.id}));
+	BOOST_TEST(removed == (std::vector<size_t>{made.id}));
+
+	// the snapshot can be restored again, and IDs are given out as they were after it was taken
+	base.get_storage_component(type_c<position>, kept.id).x = 20.f;
+	derived.restore(snap);
+	BOOST_TEST(base.get_storage_component(type_c<position>, kept.id).x == 1.f);
+	BOOST_TEST(derived.new_entity(make_type_tuple<velocity>).id == made.id);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_reads_test)
+{
+	auto man = create_manager(make_type_tuple<position, velocity, player>);
+	man.create_entity_batch(make_type_tuple<position, velocity>,
+							make_tuple(position{1.f, 2.f}, velocity{}), 10000);
+	auto snap = man.snapshot();
+
+	auto shared = [&man] {
+		auto stats = man.memory_stats();
+		return std::vector<size_t>{stats.signatures.segments_shared,
+								   stats.components[0].storage.segments_shared,
+								   stats.components[1].storage.segments_shared};
+	};
+	auto before = shared();
+	BOOST_TEST(before[0] != 0);
+	BOOST_TEST(before[1] != 0);
+
+	// reading doesn't copy the segments shared with the snapshot
+	size_t count = 0;
+	man.run_all_matching(make_type_tuple<position>, [&count](const position&) { ++count; });
+	man.run_all_matching(make_type_tuple<velocity, optional<position>>,
+						 [&count](velocity, const position* p) { count += p != nullptr; });
+	query_cursor cursor;
+	man.run_some_matching(make_type_tuple<position>, cursor, [&count](const position&) { ++count; },
+						  query_budget{});
+	BOOST_TEST(!man.has_component(type_c<player>, 5));
+	BOOST_TEST(count == 30000);
+	BOOST_TEST(shared() == before);
+
+	// writing only copies what is written to, and a read that's under way sees the write
+	float seen = 0.f;
+	man.run_all_matching(make_type_tuple<position>, [&](const position& p) {
+		if (++count == 30001) man.get_storage_component(type_c<position>, 1).x = 5.f;
+		seen += p.x;
+	});
+	BOOST_TEST(seen == 10004.f);
+	auto after = shared();
+	BOOST_TEST(after[0] == before[0]);
+	BOOST_TEST(after[1] == before[1] - 1);
+	BOOST_TEST(after[2] == before[2]);
+
+	// a functor taking a non-const reference may write, so it gets its own copies
+	man.run_all_matching(make_type_tuple<velocity>, [](velocity&) {});
+	BOOST_TEST(shared()[2] == 0);
+}
+
+struct temperature
+{
+	float value;
+};
+}
+
+template <>
+struct ecs::double_buffered<entities::temperature> : std::true_type
+{
+};
+
+namespace entities
+{
+BOOST_AUTO_TEST_CASE(double_buffered_test)
+{
+	auto base = create_manager(make_type_tuple<temperature>);
+	auto derived = create_manager(make_type_tuple<position>, make_tuple(&base));
+
+	std::vector<size_t> ids;
+	for (int i = 0; i < 100; ++i)
+		{
+			ids.push_back(derived
+							  .new_entity(make_type_tuple<position, temperature>,
+										  make_tuple(position{}, temperature{float(i)}))
+							  .id);
+		}
+
+	// every entity takes the temperature of its left neighbour, on two threads at once: the
+	// reads never see a value written in the same frame
+	auto step = [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i)
+			{
+				auto left = ids[(i + ids.size() - 1) % ids.size()];
+				derived.get_next_component(type_c<temperature>, ids[i]).value =
+					derived.get_storage_component(type_c<temperature>, left).value;
+			}
+	};
+	for (int frame = 0; frame < 3; ++frame)
+		{
+			std::thread other{step, 0, ids.size() / 2};
+			step(ids.size() / 2, ids.size());
+			other.join();
+			derived.flip_buffers();
+		}
+	for (size_t i = 0; i < ids.size(); ++i)
+		{
+			BOOST_TEST(derived.get_storage_component(type_c<temperature>, ids[i]).value ==
+					   float((i + ids.size() - 3) % ids.size()));
+		}
+
+	// both buffers follow the entities around
+	derived.destroy_entity(ids[0]);
+	derived.compact();
+	BOOST_TEST(derived.get_storage_component(type_c<temperature>, 0).value == 98.f);
+	BOOST_TEST(derived.get_next_component(type_c<temperature>, 0).value == 99.f);
+	BOOST_TEST(!derived.get_component_storage(type_c<temperature>).next().count(99));
+
+	// nor do they share segments with a snapshot, which would make writing them in parallel
+	// unsafe
+	auto snap = derived.snapshot();
+	BOOST_TEST(derived.get_component_storage(type_c<temperature>).memory_stats().segments_shared ==
+			   0);
+	BOOST_TEST(derived.get_component_storage(type_c<position>).memory_stats().segments_shared != 0);
+}
+}
@@ -0,0 +1,70 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ecs/manager.hpp>
+
+using boost::hana::make_tuple;
+using boost::hana::type_c;
+using namespace ecs;
+
+namespace memory_stats_test
+{
+struct position
+{
+	double x, y;
+};
+struct frozen
+{
+};
+
+BOOST_AUTO_TEST_CASE(segmented_map_stats_test)
+{
+	segmented_map<size_t, double> map;
+
+	auto empty = map.memory_stats();
+	BOOST_TEST(empty.segments_allocated == 0);
+	BOOST_TEST(empty.live_elements == 0);
+
+	// one full segment, and one element in the fourth segment
+	for (size_t i = 0; i < map.segment_size; ++i)
+		{
+			map.insert({i, double(i)});
+		}
+	map.insert({map.segment_size * 3, 1.0});
+
+	auto stats = map.memory_stats();
+	BOOST_TEST(stats.directory_size == 4);
+	BOOST_TEST(stats.segments_allocated == 2);
+	BOOST_TEST(stats.live_elements == map.segment_size + 1);
+	BOOST_TEST(stats.occupancy[0] == map.segment_size);
+	BOOST_TEST(stats.occupancy[1] == 0);
+	BOOST_TEST(stats.occupancy[3] == 1);
+	BOOST_TEST(stats.occupancy_histogram[map.segment_size] == 1);
+	BOOST_TEST(stats.occupancy_histogram[1] == 1);
+	BOOST_TEST(stats.empty_slot_bytes == (map.segment_size - 1) * sizeof(double));
+	// one bit per slot, in 64 bit words
+	BOOST_TEST(stats.padding_bytes == 2 * ((map.segment_size + 63) / 64) * 8);
+}
+
+BOOST_AUTO_TEST_CASE(manager_memory_stats_test)
+{
+	auto man = create_manager(make_type_tuple<position, frozen>);
+
+	for (int i = 0; i < 100; ++i)
+		{
+			man.new_entity(make_type_tuple<position, frozen>);
+		}
+
+	auto stats = man.memory_stats();
+	BOOST_REQUIRE(stats.components.size() == 2);
+
+	BOOST_TEST(stats.components[0].component == "memory_stats_test::position");
+	BOOST_TEST(stats.components[0].storage.live_elements == 100);
+	BOOST_TEST(stats.components[0].entity_list_bytes >= 100 * sizeof(size_t));
+
+	BOOST_TEST(stats.components[1].component == "memory_stats_test::frozen");
+	BOOST_TEST(stats.components[1].storage.segments_allocated == 0);
+
+	BOOST_TEST(stats.signatures.live_elements == 100);
+	BOOST_TEST(stats.total_bytes() > 100 * sizeof(position));
+}
+}
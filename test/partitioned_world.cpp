@@ -0,0 +1,196 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ecs/partitioned_world.hpp>
+
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+using boost::hana::make_tuple;
+using namespace ecs;
+
+namespace partitioned_world_test
+{
+struct terrain
+{
+	int height;
+};
+struct position
+{
+	int x, y;
+};
+struct unit
+{
+};
+
+struct hit
+{
+	size_t target;
+	int damage;
+};
+
+BOOST_AUTO_TEST_CASE(spsc_queue_test)
+{
+	spsc_queue<int, 16> queue;
+	int popped;
+	BOOST_TEST(!queue.try_pop(popped));
+
+	constexpr int count = 100000;
+	std::thread producer{[&queue] {
+		for (int i = 0; i < count; ++i)
+			{
+				queue.push(i);
+			}
+	}};
+
+	int expected = 0;
+	while (expected < count)
+		{
+			if (queue.try_pop(popped))
+				{
+					if (popped != expected) break;
+					++expected;
+				}
+		}
+	producer.join();
+
+	BOOST_TEST(expected == count);
+	BOOST_TEST(!queue.try_pop(popped));
+}
+
+BOOST_AUTO_TEST_CASE(partitioned_world_test)
+{
+	auto world = create_manager(make_type_tuple<terrain>);
+	auto tile = world.new_entity(make_type_tuple<terrain>, make_tuple(terrain{7}));
+
+	using partition = decltype(create_manager(make_type_tuple<position, unit>, make_tuple(&world)));
+	partitioned_world<partition, hit> regions{4, make_tuple(&world), 64};
+	BOOST_TEST(regions.size() == 4);
+
+	std::vector<std::vector<size_t>> created(regions.size());
+	regions.run_parallel([&](size_t i, partition& region) {
+		for (int n = 0; n < 500; ++n)
+			{
+				auto made = region.new_entity(make_type_tuple<position, unit>,
+											  make_tuple(position{int(i), n}));
+				created[i].push_back(made.id);
+			}
+
+		// the base is shared, but reading it is fine
+		if (region.get_storage_component(boost::hana::type_c<terrain>, tile.id).height != 7)
+			{
+				throw std::runtime_error("bad terrain");
+			}
+	});
+
+	// every partition got IDs of its own
+	std::set<size_t> ids{tile.id};
+	for (auto& list : created)
+		{
+			ids.insert(list.begin(), list.end());
+		}
+	BOOST_TEST(ids.size() == 1 + 4 * 500);
+
+	// every partition hits the first unit of the next one, and moves its last unit there
+	regions.run_parallel([&](size_t i, partition& region) {
+		auto next = (i + 1) % regions.size();
+		regions.send(i, next, hit{created[next].front(), int(i) + 1});
+		regions.migrate(i, next, created[i].back(), make_type_tuple<position, unit>);
+		if (region.has_component(boost::hana::type_c<unit>, created[i].back()))
+			{
+				throw std::runtime_error("not migrated");
+			}
+	});
+
+	regions.run_parallel([&](size_t i, partition&) {
+		size_t hits = 0;
+		auto drained = regions.drain(i, [&](size_t from, hit&& message) {
+			if (message.target == created[i].front() && message.damage == int(from) + 1) ++hits;
+		});
+		if (drained != 2 || hits != 1) throw std::runtime_error("bad messages");
+	});
+
+	// the migrated unit keeps its components, in its new partition
+	for (size_t i = 0; i < regions.size(); ++i)
+		{
+			auto previous = (i + regions.size() - 1) % regions.size();
+			size_t found = 0;
+			regions[i].run_all_matching(make_type_tuple<position, unit>, [&](position& p) {
+				if (p.x == int(previous)) found += p.y == 499;
+			});
+			BOOST_TEST(found == 1);
+		}
+}
+
+struct cargo
+{
+	std::unique_ptr<int> load;
+};
+
+BOOST_AUTO_TEST_CASE(move_only_migration_test)
+{
+	using partition = decltype(create_manager(make_type_tuple<position, cargo>));
+	partitioned_world<partition, std::unique_ptr<int>> regions{2};
+
+	auto id = regions[0]
+				  .new_entity(make_type_tuple<position, cargo>,
+							  make_tuple(position{1, 2}, cargo{std::make_unique<int>(42)}))
+				  .id;
+	regions.run_parallel([&](size_t i, partition&) {
+		if (i != 0) return;
+		regions.migrate(0, 1, id, make_type_tuple<position, cargo>);
+		regions.send(0, 1, std::make_unique<int>(7));
+	});
+
+	int message = 0;
+	BOOST_TEST(regions.drain(1, [&message](size_t, std::unique_ptr<int>&& value) {
+		message = *value;
+	}) == 2);
+	BOOST_TEST(message == 7);
+
+	int load = 0;
+	regions[1].run_all_matching(make_type_tuple<position, cargo>,
+								[&load](position&, cargo& c) { load = *c.load; });
+	BOOST_TEST(load == 42);
+	BOOST_TEST(regions[0].component_count(boost::hana::type_c<cargo>) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(persistent_workers_test)
+{
+	using partition = decltype(create_manager(make_type_tuple<position>));
+	partitioned_world<partition, int> regions{3};
+
+	// every partition keeps its thread from one call to the next
+	std::vector<std::thread::id> first(regions.size()), second(regions.size());
+	regions.run_parallel([&first](size_t i, partition&) { first[i] = std::this_thread::get_id(); });
+	for (int n = 0; n < 100; ++n)
+		{
+			regions.run_parallel(
+				[&second](size_t i, partition&) { second[i] = std::this_thread::get_id(); });
+		}
+	BOOST_TEST((first == second));
+	BOOST_TEST(std::set<std::thread::id>(first.begin(), first.end()).size() == regions.size());
+}
+
+BOOST_AUTO_TEST_CASE(partitioned_world_exception_test)
+{
+	using partition = decltype(create_manager(make_type_tuple<position>));
+	partitioned_world<partition, int> regions{3};
+
+	BOOST_CHECK_THROW(regions.run_parallel([](size_t i, partition&) {
+		if (i == 1) throw std::runtime_error("partition failed");
+	}),
+					  std::runtime_error);
+
+	// the workers keep going after one of them threw
+	size_t ran = 0;
+	std::mutex mutex;
+	regions.run_parallel([&](size_t, partition&) {
+		std::lock_guard<std::mutex> lock{mutex};
+		++ran;
+	});
+	BOOST_TEST(ran == 3);
+}
+}
@@ -0,0 +1,164 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ecs/manager.hpp>
+
+#include <sstream>
+#include <thread>
+
+using boost::hana::make_tuple;
+using boost::hana::type_c;
+using namespace ecs;
+
+namespace profiler_test
+{
+struct position
+{
+	float x, y;
+};
+struct velocity
+{
+	float x, y;
+};
+
+const call_site_stats* find_site(const profiler& prof, const std::string& prefix)
+{
+	for (auto& site : prof.stats())
+		{
+			if (site.name.compare(0, prefix.size(), prefix) == 0) return &site;
+		}
+	return nullptr;
+}
+
+BOOST_AUTO_TEST_CASE(call_site_stats_test)
+{
+	auto man = create_manager(make_type_tuple<position, velocity>);
+
+	for (int i = 0; i < 10; ++i)
+		{
+			man.new_entity(make_type_tuple<position, velocity>);
+		}
+	man.new_entity(make_type_tuple<position>).destroy();
+
+	man.run_all_matching(make_type_tuple<position, velocity>, [](position&, velocity&) {});
+	man.run_all_matching(make_type_tuple<position, velocity>, [](position&, velocity&) {});
+	man.run_all_matching(make_type_tuple<position>, [](position&) {});
+
+	auto& prof = man.get_profiler();
+
+	auto creation = find_site(prof, "new_entity");
+	BOOST_REQUIRE(creation);
+	BOOST_TEST(creation->calls == 11);
+
+	auto destruction = find_site(prof, "destroy_entity");
+	BOOST_REQUIRE(destruction);
+	BOOST_TEST(destruction->calls == 1);
+
+	auto query =
+		find_site(prof, "run_all_matching<profiler_test::position, profiler_test::velocity>");
+	BOOST_REQUIRE(query);
+	BOOST_TEST(query->calls == 2);
+	BOOST_TEST(query->entities == 20);
+
+	auto growth = find_site(prof, "storage_growth<profiler_test::position>");
+	BOOST_REQUIRE(growth);
+	BOOST_TEST(growth->calls == 1);
+
+	// the bulk ways of creating entities are timed too
+	man.create_entity_batch(make_type_tuple<position>, make_tuple(position{}), 3);
+	std::vector<position> positions(5);
+	man.create_entity_batch(make_type_tuple<position>, make_tuple(make_column(positions)));
+	prefab<decltype(make_type_tuple<velocity>), decltype(make_tuple(velocity{}))> pf{
+		make_type_tuple<velocity>, make_tuple(velocity{})};
+	man.instantiate(pf, 7);
+
+	auto batches = find_site(prof, "create_entity_batch<profiler_test::position>");
+	BOOST_REQUIRE(batches);
+	BOOST_TEST(batches->calls == 2);
+	BOOST_TEST(batches->entities == 8);
+	auto instantiated = find_site(prof, "instantiate<profiler_test::velocity>");
+	BOOST_REQUIRE(instantiated);
+	BOOST_TEST(instantiated->entities == 7);
+
+	// the trace is off unless asked for
+	std::stringstream trace;
+	prof.write_chrome_trace(trace);
+	BOOST_TEST(trace.str() == "{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}");
+}
+
+BOOST_AUTO_TEST_CASE(chrome_trace_test)
+{
+	auto man = create_manager(make_type_tuple<position>);
+	man.get_profiler().set_trace_enabled(true);
+
+	man.new_entity(make_type_tuple<position>);
+	man.run_all_matching(make_type_tuple<position>, [](position&) {});
+
+	std::stringstream trace;
+	man.get_profiler().write_chrome_trace(trace);
+
+	auto str = trace.str();
+	BOOST_TEST(str.find("{\"traceEvents\":[") == 0);
+	BOOST_TEST(str.find("\"name\":\"run_all_matching<profiler_test::position>\"") !=
+			   std::string::npos);
+	BOOST_TEST(str.find("\"ph\":\"X\"") != std::string::npos);
+
+	man.get_profiler().reset();
+	BOOST_TEST(find_site(man.get_profiler(), "new_entity")->calls == 0);
+}
+
+BOOST_AUTO_TEST_CASE(hardware_counters_test)
+{
+	auto man = create_manager(make_type_tuple<position, velocity>);
+	for (int i = 0; i < 1000; ++i)
+		{
+			man.new_entity(make_type_tuple<position, velocity>);
+		}
+
+	auto& prof = man.get_profiler();
+	perf_counter_group group;
+	BOOST_TEST(prof.set_hardware_counters_enabled(true) == group.available());
+
+	man.run_all_matching(make_type_tuple<position, velocity>, [](position& p, velocity& v) {
+		p.x += v.x;
+	});
+
+	auto query =
+		find_site(prof, "run_all_matching<profiler_test::position, profiler_test::velocity>");
+	BOOST_REQUIRE(query);
+	if (group.available())
+		{
+			BOOST_TEST(query->counted_calls == 1);
+			// the task clock is a software event, so it is there even in a virtual machine
+			if (group.supported(hardware_counter::task_clock))
+				{
+					BOOST_TEST(query->counters[hardware_counter::task_clock] != 0);
+				}
+			if (group.supported(hardware_counter::instructions))
+				{
+					BOOST_TEST(query->counters[hardware_counter::instructions] > 1000);
+				}
+		}
+	// creating the entities happened before
+	BOOST_TEST(find_site(prof, "new_entity")->counted_calls == 0);
+
+	// calls on other threads aren't counted
+	std::thread other{[&man] { man.run_all_matching(make_type_tuple<position>, [](position&) {}); }};
+	other.join();
+	BOOST_TEST(find_site(prof, "run_all_matching<profiler_test::position>")->counted_calls == 0);
+
+	prof.set_hardware_counters_enabled(false);
+	man.run_all_matching(make_type_tuple<position, velocity>, [](position&, velocity&) {});
+	query = find_site(prof, "run_all_matching<profiler_test::position, profiler_test::velocity>");
+	BOOST_TEST(query->calls == 2);
+	BOOST_TEST(query->counted_calls == (group.available() ? 1 : 0));
+
+	std::stringstream dump;
+	prof.write_counters(dump);
+	std::string header;
+	std::getline(dump, header);
+	BOOST_TEST(header == "site,calls,entities,total_ns,counted_calls,cycles,instructions,"
+						 "l1d_read_misses,llc_read_misses,branch_misses,task_clock");
+	BOOST_TEST(dump.str().find("\"run_all_matching<profiler_test::position, "
+							   "profiler_test::velocity>\",2,2000,") != std::string::npos);
+}
+}
@@ -0,0 +1,79 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ecs/manager.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <numeric>
+
+#ifdef MOD_ECS_TEST_PARALLEL
+#include <execution>
+#endif
+
+using boost::hana::make_tuple;
+using boost::hana::type_c;
+using namespace ecs;
+
+namespace query_view_test
+{
+struct mass
+{
+	float value;
+};
+struct velocity
+{
+	float x, y;
+};
+struct ship
+{
+};
+
+BOOST_AUTO_TEST_CASE(query_test)
+{
+	auto base = create_manager(make_type_tuple<mass>);
+	auto derived = create_manager(make_type_tuple<velocity, ship>, make_tuple(&base));
+
+	for (int i = 0; i < 1000; ++i)
+		{
+			derived.new_entity(make_type_tuple<mass, velocity, ship>,
+							   make_tuple(mass{1.f}, velocity{float(i), 0.f}));
+			derived.new_entity(make_type_tuple<mass>, make_tuple(mass{100.f}));
+		}
+
+	auto ships = derived.query(make_type_tuple<mass, ship, velocity>);
+	BOOST_TEST(ships.size() == 1000);
+	BOOST_TEST(std::distance(ships.begin(), ships.end()) == 1000);
+	BOOST_TEST(ships.ids()[1] == 2);
+
+	// the tuple has the storage components only, in the order of the signature
+	auto third = ships[3];
+	BOOST_TEST(std::get<1>(third).x == 3.f);
+	BOOST_TEST((ships.begin() + 3).id() == 6);
+
+	auto speedUp = [](auto components) {
+		std::get<1>(components).y = std::get<0>(components).value;
+	};
+	auto massOf = [](auto components) { return std::get<0>(components).value; };
+#ifdef MOD_ECS_TEST_PARALLEL
+	std::for_each(std::execution::par_unseq, ships.begin(), ships.end(), speedUp);
+	auto total = std::transform_reduce(std::execution::par_unseq, ships.begin(), ships.end(), 0.f,
+									   std::plus<>{}, massOf);
+#else
+	std::for_each(ships.begin(), ships.end(), speedUp);
+	auto total = std::transform_reduce(ships.begin(), ships.end(), 0.f, std::plus<>{}, massOf);
+#endif
+	BOOST_TEST(total == 1000.f);
+	BOOST_TEST(derived.get_storage_component(type_c<velocity>, 1998).y == 1.f);
+
+	// writes through the view don't reach a snapshot taken before
+	auto snap = derived.snapshot();
+	auto moved = derived.query(make_type_tuple<velocity>);
+	for (auto&& components : moved)
+		{
+			std::get<0>(components).x = -1.f;
+		}
+	derived.restore(snap);
+	BOOST_TEST(derived.get_storage_component(type_c<velocity>, 0).x == 0.f);
+}
+}
@@ -0,0 +1,259 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ecs/segmented_map.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+BOOST_AUTO_TEST_CASE(insert_find_erase_test)
+{
+	segmented_map<size_t, int> map;
+
+	BOOST_TEST(map.empty());
+	BOOST_TEST(map.insert({3, 30}).second);
+	BOOST_TEST(!map.insert({3, 31}).second);
+	map.insert({1000, 10});
+
+	BOOST_TEST(map.size() == 2);
+	BOOST_TEST(map.count(3) == 1);
+	BOOST_TEST(map.count(4) == 0);
+	BOOST_TEST(map.at(3) == 30);
+	BOOST_CHECK_THROW(map.at(4), std::out_of_range);
+	BOOST_TEST(map.find(1000)->second == 10);
+
+	BOOST_TEST(map.erase(3) == 1);
+	BOOST_TEST(map.erase(3) == 0);
+	BOOST_TEST(map.begin()->first == 1000);
+}
+
+BOOST_AUTO_TEST_CASE(iteration_test)
+{
+	segmented_map<size_t, int> map{{5, 1}, {700, 2}, {6, 3}};
+
+	std::vector<size_t> keys;
+	for (auto&& elem : map)
+		{
+			keys.push_back(elem.first);
+		}
+	BOOST_TEST(keys == (std::vector<size_t>{5, 6, 700}));
+
+	keys.clear();
+	map.for_each([&keys](size_t key, int&) { keys.push_back(key); });
+	BOOST_TEST(keys == (std::vector<size_t>{5, 6, 700}));
+
+	auto copy = map;
+	copy[5] = 10;
+	BOOST_TEST(map[5] == 1);
+	BOOST_TEST(copy[5] == 10);
+}
+
+BOOST_AUTO_TEST_CASE(cursor_test)
+{
+	segmented_map<size_t, int> map;
+	for (size_t i = 0; i < 1000; i += 3)
+		{
+			map.insert({i, int(i)});
+		}
+
+	auto cursor = map.make_cursor();
+	for (size_t i = 0; i < 1000; i += 3)
+		{
+			BOOST_TEST(cursor[i] == int(i));
+		}
+
+	// going backwards works too, it just doesn't get any faster
+	cursor[999] = -1;
+	BOOST_TEST(cursor[3] == 3);
+	BOOST_TEST(map[999] == -1);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_reader_test)
+{
+	// enough segments to grow the directory through several of its blocks
+	constexpr size_t numElements = 200000;
+
+	segmented_map<size_t, size_t> map;
+	std::atomic<size_t> published{0};
+
+	std::thread reader{[&] {
+		size_t checked = 0;
+		while (checked < numElements)
+			{
+				auto last = published.load(std::memory_order_acquire);
+				for (; checked < last; ++checked)
+					{
+						// looked up from the start every time, through the directory
+						if (map.at(checked / 2) != checked / 2) return;
+					}
+			}
+	}};
+
+	for (size_t i = 0; i < numElements; ++i)
+		{
+			map.insert({i, i});
+			published.store(i + 1, std::memory_order_release);
+		}
+	reader.join();
+
+	BOOST_TEST(map.at(numElements - 1) == numElements - 1);
+	BOOST_TEST(map.memory_stats().directory_size ==
+			   (numElements + map.segment_size - 1) / map.segment_size);
+}
+
+BOOST_AUTO_TEST_CASE(move_only_test)
+{
+	// copies share segments, which can't be copied when written to
+	static_assert(!std::is_copy_constructible<segmented_map<size_t, std::unique_ptr<int>>>::value);
+	static_assert(!std::is_copy_assignable<segmented_map<size_t, std::unique_ptr<int>>>::value);
+	static_assert(std::is_copy_constructible<segmented_map<size_t, int>>::value);
+
+	segmented_map<size_t, std::unique_ptr<int>> map;
+
+	BOOST_TEST(map.emplace(1, std::make_unique<int>(1)).second);
+	BOOST_TEST(map.try_emplace(2, new int(2)).second);
+	BOOST_TEST(map.insert({3, std::make_unique<int>(3)}).second);
+	BOOST_TEST(map.insert_or_assign(3, std::make_unique<int>(4)).second == false);
+
+	// an existing key leaves the arguments alone
+	auto keep = std::make_unique<int>(5);
+	BOOST_TEST(!map.try_emplace(1, std::move(keep)).second);
+	BOOST_TEST(bool(keep));
+
+	BOOST_TEST(*map[1] == 1);
+	BOOST_TEST(*map[2] == 2);
+	BOOST_TEST(*map[3] == 4);
+}
+
+BOOST_AUTO_TEST_CASE(in_place_test)
+{
+	segmented_map<size_t, std::string> map;
+
+	map.try_emplace(0, 3, 'a');
+	map.emplace(std::piecewise_construct, std::forward_as_tuple(1), std::forward_as_tuple("bc"));
+
+	BOOST_TEST(map[0] == "aaa");
+	BOOST_TEST(map[1] == "bc");
+}
+
+BOOST_AUTO_TEST_CASE(segment_size_test)
+{
+	// elements larger than a segment's target size still get several per segment
+	using big = std::array<char, 5000>;
+	segmented_map<size_t, big> bigMap;
+	BOOST_TEST(bigMap.segment_size == segment_traits<big>::min_elements);
+
+	bigMap.try_emplace(7).first->second[0] = 'x';
+	BOOST_TEST(bigMap.at(7)[0] == 'x');
+
+	// the segments are aligned, so the first elements of every segment are at the same offset
+	// from a cache line
+	auto lineOffset = [&bigMap](size_t key) {
+		return reinterpret_cast<std::uintptr_t>(&bigMap[key]) % segment_alignment;
+	};
+	for (size_t key = 0; key < 40; key += 4)
+		{
+			bigMap.try_emplace(key);
+			BOOST_TEST(lineOffset(key) == lineOffset(0));
+		}
+
+	// the size can be given directly too
+	segmented_map<size_t, int, std::less<size_t>, std::allocator<std::pair<size_t, int>>, 3> small;
+	BOOST_TEST(small.segment_size == 3);
+	for (size_t i = 0; i < 10; ++i)
+		{
+			small.insert({i, int(i)});
+		}
+	BOOST_TEST(small.memory_stats().segments_allocated == 4);
+	BOOST_TEST(small[9] == 9);
+}
+
+BOOST_AUTO_TEST_CASE(copy_on_write_test)
+{
+	segmented_map<size_t, int> map;
+	for (size_t i = 0; i < 3000; ++i)
+		{
+			map.insert({i, int(i)});
+		}
+	auto segments = map.memory_stats().segments_allocated;
+
+	// a copy shares every segment until it is written to
+	auto copy = map;
+	BOOST_TEST(copy.memory_stats().segments_shared == segments);
+	BOOST_TEST(copy[2999] == 2999);
+
+	copy.at(5) = -5;
+	copy.erase(2999);
+	BOOST_TEST(map.at(5) == 5);
+	BOOST_TEST(map.count(2999) == 1);
+	BOOST_TEST(copy.at(5) == -5);
+	BOOST_TEST(copy.count(2999) == 0);
+	BOOST_TEST(map.memory_stats().segments_shared == segments - 2);
+
+	// the original can still be written to once the copy is gone
+	copy = segmented_map<size_t, int>{};
+	map.at(6) = -6;
+	BOOST_TEST(map.memory_stats().segments_shared == 0);
+	BOOST_TEST(map.at(6) == -6);
+}
+
+BOOST_AUTO_TEST_CASE(gather_scatter_test)
+{
+	segmented_map<size_t, int> map;
+	for (size_t i = 0; i < 5000; i += 2)
+		{
+			map.insert({i, int(i)});
+		}
+
+	// the output keeps the order of the keys, sorted or not
+	std::vector<size_t> keys{4000, 2, 1024, 0, 4998, 2};
+	std::vector<int> values(keys.size());
+	map.gather(keys, values.begin());
+	BOOST_TEST(values == (std::vector<int>{4000, 2, 1024, 0, 4998, 2}));
+
+	std::vector<size_t> sorted{10, 20, 30};
+	map.scatter(sorted, std::vector<int>{-1, -2, -3}.begin());
+	BOOST_TEST(map[20] == -2);
+
+	BOOST_CHECK_THROW(map.gather(std::vector<size_t>{3}, values.begin()), std::out_of_range);
+	BOOST_CHECK_THROW(map.scatter(std::vector<size_t>{100000}, values.begin()), std::out_of_range);
+
+	// a few keys over many segments are sorted instead of bucketed
+	segmented_map<size_t, int, std::less<size_t>, std::allocator<std::pair<size_t, int>>, 4> large;
+	for (size_t i = 0; i < 40000; ++i)
+		{
+			large.insert({i, int(i)});
+		}
+	large.gather(keys, values.begin());
+	BOOST_TEST(values == (std::vector<int>{4000, 2, 1024, 0, 4998, 2}));
+	large.scatter(std::vector<size_t>{39999, 7}, std::vector<int>{-1, -2}.begin());
+	BOOST_TEST(large[39999] == -1);
+	BOOST_TEST(large[7] == -2);
+	BOOST_CHECK_THROW(large.gather(std::vector<size_t>{50000, 3}, values.begin()),
+					  std::out_of_range);
+	BOOST_TEST(values[1] == 3);
+}
+
+BOOST_AUTO_TEST_CASE(assign_values_test)
+{
+	segmented_map<size_t, int> map;
+	for (size_t i = 4000; i < 4200; i += 2)
+		{
+			map.insert({i, -1});
+		}
+
+	// over a segment boundary, replacing some elements
+	std::vector<int> column(100);
+	std::iota(column.begin(), column.end(), 10000);
+	map.assign_values(4090, column.begin(), column.size());
+	BOOST_TEST(map[4090] == 10000);
+	BOOST_TEST(map[4091] == 10001);
+	BOOST_TEST(map[4189] == 10099);
+	BOOST_TEST(map[4190] == -1);
+	BOOST_TEST(map.size() == 100 + 50);
+}
@@ -0,0 +1,151 @@
+#include <boost/test/unit_test.hpp>
+
+#include <ecs/workload_replay.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using boost::hana::make_tuple;
+using namespace ecs;
+
+namespace workload_trace_test
+{
+struct position
+{
+	float x, y;
+};
+struct velocity
+{
+	float x, y;
+};
+struct frozen
+{
+};
+
+BOOST_AUTO_TEST_CASE(record_replay_test)
+{
+	auto recorded = create_manager(make_type_tuple<position, velocity, frozen>);
+	// entities made before recording aren't in the trace
+	auto before = recorded.new_entity(make_type_tuple<position>);
+
+	workload_recorder recorder;
+	recorded.record_workload(&recorder);
+
+	std::vector<size_t> movers;
+	for (int i = 0; i < 10; ++i)
+		{
+			movers.push_back(recorded
+								 .new_entity(make_type_tuple<position, velocity>,
+											 make_tuple(position{float(i), 0.f}, velocity{}))
+								 .id);
+		}
+	recorded.create_entity_batch(make_type_tuple<position, frozen>, make_tuple(position{}), 5);
+	recorded.instantiate(recorded.make_prefab(make_type_tuple<position, velocity>, movers[0]), 20);
+	recorded.destroy_entity(movers[3]);
+	recorded.destroy_entity(before.id);
+	// the entities keep their numbers in the trace when they are moved
+	auto moves = recorded.sort_entities(make_type_tuple<position, velocity>,
+										[](const position& p, const velocity&) { return -p.x; });
+	auto moved4 = std::find_if(moves.begin(), moves.end(),
+							   [&movers](auto move) { return move.first == movers[4]; });
+	BOOST_REQUIRE(moved4 != moves.end());
+	recorded.destroy_entity(moved4->second);
+
+	size_t moved = 0;
+	recorded.run_all_matching(make_type_tuple<position, velocity>,
+							  [&moved](position&, velocity&) { ++moved; });
+	recorded.run_all_matching(make_type_tuple<position, without<velocity>>,
+							  [](position&) {});
+	query_cursor cursor;
+	recorded.run_some_matching(make_type_tuple<position, velocity>, cursor,
+							   [](position&, velocity&) {}, query_budget{7});
+	// a spawner's entities are recorded when they are merged, a batch per signature
+	auto spawner = recorded.make_spawner();
+	spawner.new_entity(make_type_tuple<position, velocity>);
+	auto spawned = spawner.new_entity(make_type_tuple<position, velocity>);
+	spawner.new_entity(make_type_tuple<position, frozen>);
+	recorded.merge_spawned(spawner);
+	recorded.destroy_entity(spawned);
+	// the budget asked for is recorded, even if more entities are visited
+	query_cursor frozenCursor;
+	recorded.run_some_matching(make_type_tuple<position, frozen>, frozenCursor,
+							   [](position&) {}, query_budget{0});
+	auto frozenCount = recorded.query(make_type_tuple<position, frozen>).size();
+	recorded.record_workload(nullptr);
+	recorded.new_entity(make_type_tuple<position>);
+
+	const auto& trace = recorder.trace();
+	BOOST_TEST(trace.signatures.size() == 3);
+	BOOST_TEST(trace.signatures[0] ==
+			   "<workload_trace_test::position, workload_trace_test::velocity>");
+	BOOST_TEST(trace.events.size() == 10 + 1 + 1 + 2 + 4 + 2 + 1 + 1);
+	BOOST_TEST(int(trace.events[11].op) == int(workload_op::instantiate));
+	BOOST_TEST(trace.events[11].argument == 20);
+	BOOST_TEST(trace.events[12].argument == 3);
+	BOOST_TEST(trace.events[13].argument == 4);
+	BOOST_TEST(trace.events[16].argument == 7);
+	BOOST_TEST(int(trace.events[17].op) == int(workload_op::create_entity_batch));
+	BOOST_TEST(trace.events[17].argument == 2);
+	BOOST_TEST(trace.events[18].argument == 1);
+	BOOST_TEST(trace.events[19].argument == 10 + 5 + 20 + 1);
+	BOOST_TEST(int(trace.events[20].op) == int(workload_op::run_some_matching));
+	BOOST_TEST(trace.events[20].argument == 0);
+
+	std::stringstream file;
+	trace.write(file);
+	// besides the names, a byte for the operation and one for each small integer
+	size_t namesSize = 0;
+	for (const auto& name : trace.signatures)
+		{
+			namesSize += name.size() + 1;
+		}
+	BOOST_TEST(file.str().size() <= 4 + 1 + 1 + namesSize + 1 + 3 * trace.events.size());
+
+	auto read = workload_trace::read(file);
+	BOOST_TEST(read.signatures == trace.signatures);
+	BOOST_REQUIRE(read.events.size() == trace.events.size());
+	for (size_t i = 0; i < read.events.size(); ++i)
+		{
+			BOOST_TEST(int(read.events[i].op) == int(trace.events[i].op));
+			BOOST_TEST(read.events[i].signature == trace.events[i].signature);
+			BOOST_TEST(read.events[i].argument == trace.events[i].argument);
+		}
+
+	// replay on another configuration: the velocities live in a derived manager
+	auto base = create_manager(make_type_tuple<position, frozen>);
+	auto derived = create_manager(make_type_tuple<velocity>, make_tuple(&base));
+	auto signatures = make_tuple(make_type_tuple<position, velocity>,
+								 make_type_tuple<position, frozen>,
+								 make_type_tuple<position, without<velocity>>);
+	auto stats = replay_workload(derived, read, signatures);
+
+	BOOST_TEST(stats.calls[size_t(workload_op::new_entity)] == 10);
+	BOOST_TEST(stats.calls[size_t(workload_op::create_entity_batch)] == 3);
+	BOOST_TEST(stats.calls[size_t(workload_op::destroy_entity)] == 3);
+	BOOST_TEST(stats.entities_visited == moved + 5 + 7 + 1 + frozenCount);
+	BOOST_TEST(derived.component_count(boost::hana::type_c<velocity>) == 10 + 20 - 2 + 1);
+	BOOST_TEST(derived.component_count(boost::hana::type_c<frozen>) == 5 + 1);
+}
+
+BOOST_AUTO_TEST_CASE(bad_trace_test)
+{
+	std::stringstream notATrace{"not a trace"};
+	BOOST_CHECK_THROW(workload_trace::read(notATrace), std::runtime_error);
+
+	workload_trace trace;
+	trace.signatures.push_back("<workload_trace_test::velocity>");
+	trace.events.push_back({workload_op::new_entity, 0, 0});
+
+	std::stringstream file;
+	trace.write(file);
+	auto truncated = file.str();
+	truncated.pop_back();
+	std::stringstream truncatedFile{truncated};
+	BOOST_CHECK_THROW(workload_trace::read(truncatedFile), std::runtime_error);
+
+	auto man = create_manager(make_type_tuple<position, velocity>);
+	BOOST_CHECK_THROW(replay_workload(man, trace, make_tuple(make_type_tuple<position>)),
+					  std::invalid_argument);
+}
+}